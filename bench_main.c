@@ -0,0 +1,411 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "sudoku.h"
+#include "solver.h"
+
+#define MAX_ENGINES 8
+
+static int warmup = 1;
+static int repeat = 5;
+static bool count_solutions = true;
+
+struct corpus {
+    const char *name;
+    sudoku_t *puzzles;
+    int n;
+};
+
+struct result {
+    const char *corpus;
+    const char *engine;
+    int n_puzzles;
+    int n_samples;
+    double total_s;
+    double p50_us, p90_us, p99_us, max_us;
+    long solutions;
+};
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static bool load_corpus(struct corpus *c, const char *fn)
+{
+    FILE *fp = fopen(fn, "r");
+    int size = 1024;
+
+    if (!fp) {
+        fprintf(stderr, "Error opening %s: ", fn);
+        perror(NULL);
+        return false;
+    }
+
+    c->name = fn;
+    c->n = 0;
+    c->puzzles = malloc(size * sizeof(sudoku_t));
+    if (!c->puzzles) {
+        fprintf(stderr, "Error reading %s: out of memory\n", fn);
+        fclose(fp);
+        return false;
+    }
+
+    struct sudoku_reader *reader = sudoku_reader_open(fp);
+    bool ok = true;
+    if (!reader) {
+        fprintf(stderr, "Error reading %s: out of memory\n", fn);
+        free(c->puzzles);
+        c->puzzles = NULL;
+        fclose(fp);
+        return false;
+    }
+    while (sudoku_reader_next(reader, c->puzzles[c->n]) > 0) {
+        if (++c->n == size) {
+            sudoku_t *more = realloc(c->puzzles, 2 * size * sizeof(sudoku_t));
+            if (!more) {
+                fprintf(stderr, "Error reading %s: out of memory\n", fn);
+                free(c->puzzles);
+                c->puzzles = NULL;
+                ok = false;
+                break;
+            }
+            c->puzzles = more;
+            size *= 2;
+        }
+    }
+    sudoku_reader_close(reader);
+    fclose(fp);
+    return ok;
+}
+
+static int run_one(sudoku_t puzzle)
+{
+    sudoku_t s;
+    memcpy(s, puzzle, sizeof(sudoku_t));
+    if (count_solutions)
+        return count_sudoku_solutions(s);
+    else
+        return solve_sudoku(s);
+}
+
+// An engine to measure, optionally followed by a propagation level and
+// a branching, each after a colon and in either order, e.g.
+// classic:locked:degree
+static bool parse_engine(const char *spec, enum solver_engine *engine,
+                         enum solver_propagation *level,
+                         enum solver_branching *branching)
+{
+    char name[32];
+    bool first = true;
+
+    *level = PROPAGATE_SINGLES;
+    *branching = BRANCH_FIRST;
+    while (*spec) {
+        const char *colon = strchr(spec, ':');
+        size_t n = colon ? (size_t) (colon - spec) : strlen(spec);
+
+        if (n >= sizeof(name))
+            return false;
+        memcpy(name, spec, n);
+        name[n] = 0;
+        spec += colon ? n + 1 : n;
+
+        if (first) {
+            if (!solver_engine_from_name(name, engine))
+                return false;
+            first = false;
+        } else if (!solver_propagation_from_name(name, level)
+                   && !solver_branching_from_name(name, branching)) {
+            return false;
+        }
+    }
+    return !first;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const double *sorted, int n, double p)
+{
+    int rank = (int) (p / 100.0 * n + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return sorted[rank - 1];
+}
+
+// false if there is no memory for the samples
+static bool run_bench(struct corpus *c, const char *engine, struct result *r,
+                      FILE *csv)
+{
+    int n_samples = c->n * repeat;
+    double *samples = malloc(n_samples * sizeof(double));
+    double t0, t1;
+
+    if (samples == NULL)
+        return false;
+
+    for (int rep=0; rep<warmup; ++rep)
+        for (int i=0; i<c->n; ++i)
+            run_one(c->puzzles[i]);
+
+    r->corpus = c->name;
+    r->engine = engine;
+    r->n_puzzles = c->n;
+    r->n_samples = n_samples;
+    r->total_s = 0;
+    r->solutions = 0;
+
+    for (int rep=0; rep<repeat; ++rep) {
+        for (int i=0; i<c->n; ++i) {
+            t0 = now_us();
+            int n = run_one(c->puzzles[i]);
+            t1 = now_us();
+
+            samples[rep * c->n + i] = t1 - t0;
+            r->total_s += (t1 - t0) / 1e6;
+            if (rep == 0)
+                r->solutions += n;
+            if (csv)
+                fprintf(csv, "%s,%s,%d,%d,%.3f,%d\n",
+                        c->name, engine, i, rep, t1 - t0, n);
+        }
+    }
+
+    qsort(samples, n_samples, sizeof(double), compare_doubles);
+    r->p50_us = percentile(samples, n_samples, 50);
+    r->p90_us = percentile(samples, n_samples, 90);
+    r->p99_us = percentile(samples, n_samples, 99);
+    r->max_us = samples[n_samples - 1];
+
+    free(samples);
+    return true;
+}
+
+// Puzzles per second; 0 if the clock saw no time pass at all
+static double throughput(const struct result *r)
+{
+    return r->total_s > 0 ? r->n_samples / r->total_s : 0;
+}
+
+static void print_result(struct result *r)
+{
+    printf("%-20s %-22s %8d %12.1f %10.1f %10.1f %10.1f %10.1f\n",
+           r->corpus, r->engine, r->n_puzzles,
+           throughput(r),
+           r->p50_us, r->p90_us, r->p99_us, r->max_us);
+}
+
+// s as a JSON string, quotes included
+static void write_json_string(FILE *fp, const char *s)
+{
+    putc('"', fp);
+    for (; *s; ++s) {
+        unsigned char ch = *s;
+        if (ch == '"' || ch == '\\')
+            fprintf(fp, "\\%c", ch);
+        else if (ch < 0x20)
+            fprintf(fp, "\\u%04x", ch);
+        else
+            putc(ch, fp);
+    }
+    putc('"', fp);
+}
+
+static void write_json(FILE *fp, struct result *results, int n)
+{
+    fprintf(fp, "{\n  \"warmup\": %d,\n  \"repeat\": %d,\n"
+                "  \"mode\": \"%s\",\n  \"results\": [\n",
+            warmup, repeat, count_solutions ? "count" : "solve");
+    for (int i=0; i<n; ++i) {
+        struct result *r = &results[i];
+        fprintf(fp, "    {\"corpus\": ");
+        write_json_string(fp, r->corpus);
+        fprintf(fp, ", \"engine\": ");
+        write_json_string(fp, r->engine);
+        fprintf(fp, ", \"puzzles\": %d, \"samples\": %d, "
+                    "\"total_s\": %.6f, \"puzzles_per_s\": %.1f, "
+                    "\"p50_us\": %.3f, \"p90_us\": %.3f, "
+                    "\"p99_us\": %.3f, \"max_us\": %.3f, "
+                    "\"solutions\": %ld}%s\n",
+                r->n_puzzles, r->n_samples,
+                r->total_s, throughput(r),
+                r->p50_us, r->p90_us, r->p99_us, r->max_us,
+                r->solutions, (i == n - 1) ? "" : ",");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *engines[MAX_ENGINES];
+    int n_engines = 0;
+    const char *csv_fn = NULL, *json_fn = NULL;
+    FILE *csv = NULL;
+
+    static struct option long_options[] = {
+        {"help",              no_argument, 0, 'h'},
+        {"warmup",            required_argument, 0, 'w'},
+        {"repeat",            required_argument, 0, 'r'},
+        {"engine",            required_argument, 0, 'e'},
+        {"do-not-count",      no_argument, 0, 'C'},
+        {"csv",               required_argument, 0, 'c'},
+        {"json",              required_argument, 0, 'j'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "hw:r:e:Cc:j:", long_options, NULL))
+                != -1) {
+        switch (c) {
+            case 'h':
+                fprintf(stderr,
+                    "Usage: %s [-h] [-C] [-w n] [-r n] [-e engine ...] "
+                    "[--csv file] [--json file] sudoku_file ...\n"
+                    "\n"
+                    "Options:\n"
+                    "    --help -h\n"
+                    "        Display this help message\n"
+                    "    --warmup=n -w n\n"
+                    "        Solve every puzzle n times before measuring (default 1)\n"
+                    "    --repeat=n -r n\n"
+                    "        Measure every puzzle n times (default 5)\n"
+                    "    --engine=engine -e engine\n"
+                    "        Benchmark this engine; may be given several times\n"
+                    "        (default: bitboard). engine:level and engine:order\n"
+                    "        set the propagation level and the branching of the\n"
+                    "        classic and trail engines, e.g. classic:locked:degree\n"
+                    "        (see sudoku --propagation and --branching).\n"
+                    "    --do-not-count -C\n"
+                    "        Stop at the first solution instead of counting\n"
+                    "    --csv=file\n"
+                    "        Write every single measurement to file\n"
+                    "    --json=file\n"
+                    "        Write the summary to file\n",
+                    argv[0]);
+                return 0;
+            case 'w':
+                warmup = atoi(optarg);
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                if (repeat < 1) repeat = 1;
+                break;
+            case 'e':
+                if (n_engines == MAX_ENGINES) {
+                    fprintf(stderr, "ERROR: too many engines\n");
+                    return 2;
+                }
+                engines[n_engines++] = optarg;
+                break;
+            case 'C':
+                count_solutions = false;
+                break;
+            case 'c':
+                csv_fn = optarg;
+                break;
+            case 'j':
+                json_fn = optarg;
+                break;
+            default:
+                return 2;
+        }
+    }
+
+    if (n_engines == 0)
+        engines[n_engines++] = "bitboard";
+
+    for (int k=0; k<n_engines; ++k) {
+        enum solver_engine e;
+        enum solver_propagation level;
+        enum solver_branching branching;
+        if (!parse_engine(engines[k], &e, &level, &branching)) {
+            fprintf(stderr, "ERROR: unknown engine %s\n", engines[k]);
+            return 2;
+        }
+    }
+
+    if (optind == argc) {
+        fprintf(stderr, "ERROR: no sudoku files given\n");
+        return 2;
+    }
+
+    int n_corpora = argc - optind;
+    struct corpus *corpora = malloc(n_corpora * sizeof(struct corpus));
+    if (corpora == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return 1;
+    }
+    for (int i=0; i<n_corpora; ++i) {
+        if (!load_corpus(&corpora[i], argv[optind + i]))
+            return 1;
+    }
+
+    if (csv_fn) {
+        csv = fopen(csv_fn, "w");
+        if (!csv) {
+            fprintf(stderr, "Error opening %s: ", csv_fn);
+            perror(NULL);
+            return 1;
+        }
+        fprintf(csv, "corpus,engine,puzzle,repetition,time_us,solutions\n");
+    }
+
+    struct result *results = malloc(n_corpora * n_engines * sizeof(struct result));
+    int n_results = 0;
+    if (results == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return 1;
+    }
+
+    printf("%-20s %-22s %8s %12s %10s %10s %10s %10s\n",
+           "corpus", "engine", "puzzles", "puzzles/s",
+           "p50 us", "p90 us", "p99 us", "max us");
+
+    for (int i=0; i<n_corpora; ++i) {
+        if (corpora[i].n == 0)
+            continue;
+        for (int k=0; k<n_engines; ++k) {
+            parse_engine(engines[k], &solver_engine, &solver_propagation,
+                         &solver_branching);
+            if (!run_bench(&corpora[i], engines[k], &results[n_results],
+                           csv)) {
+                fprintf(stderr, "ERROR: out of memory\n");
+                return 1;
+            }
+            print_result(&results[n_results]);
+            n_results++;
+        }
+    }
+
+    if (csv)
+        fclose(csv);
+
+    if (json_fn) {
+        FILE *fp = fopen(json_fn, "w");
+        if (!fp) {
+            fprintf(stderr, "Error opening %s: ", json_fn);
+            perror(NULL);
+            return 1;
+        }
+        write_json(fp, results, n_results);
+        fclose(fp);
+    }
+
+    for (int i=0; i<n_corpora; ++i)
+        free(corpora[i].puzzles);
+    free(corpora);
+    free(results);
+    return 0;
+}
@@ -0,0 +1,388 @@
+#include "bitboard.h"
+
+// An 81-bit board with one bit per cell (index 9*row + column).
+// Cells 0..63 live in lo, cells 64..80 in the low 17 bits of hi.
+typedef struct {
+    uint64_t lo, hi;
+} bb_t;
+
+struct bb_state {
+    bb_t cand[9];           // cells where digit d+1 is still possible
+    bb_t unsolved;          // cells that have not been placed yet
+    uint32_t placed[9];     // units (9 rows, 9 cols, 9 boxes) containing d+1
+};
+
+struct bb_search {
+    struct solver_stats *stats;
+    bool check_unique;
+    solution_collector collect;
+    void *collect_arg;
+    int max_solutions;
+    int found;
+    bool stop;
+    struct solver_budget *budget;
+    struct bb_state solution;
+};
+
+#define ALL_UNITS 0x7ffffff
+
+static const bb_t all_cells = { 0xffffffffffffffffULL, 0x1ffffULL };
+
+static const bb_t unit_mask[27] = {
+    // rows
+    { 0x00000000000001ffULL, 0x00000ULL },
+    { 0x000000000003fe00ULL, 0x00000ULL },
+    { 0x0000000007fc0000ULL, 0x00000ULL },
+    { 0x0000000ff8000000ULL, 0x00000ULL },
+    { 0x00001ff000000000ULL, 0x00000ULL },
+    { 0x003fe00000000000ULL, 0x00000ULL },
+    { 0x7fc0000000000000ULL, 0x00000ULL },
+    { 0x8000000000000000ULL, 0x000ffULL },
+    { 0x0000000000000000ULL, 0x1ff00ULL },
+    // columns
+    { 0x8040201008040201ULL, 0x00100ULL },
+    { 0x0080402010080402ULL, 0x00201ULL },
+    { 0x0100804020100804ULL, 0x00402ULL },
+    { 0x0201008040201008ULL, 0x00804ULL },
+    { 0x0402010080402010ULL, 0x01008ULL },
+    { 0x0804020100804020ULL, 0x02010ULL },
+    { 0x1008040201008040ULL, 0x04020ULL },
+    { 0x2010080402010080ULL, 0x08040ULL },
+    { 0x4020100804020100ULL, 0x10080ULL },
+    // boxes
+    { 0x00000000001c0e07ULL, 0x00000ULL },
+    { 0x0000000000e07038ULL, 0x00000ULL },
+    { 0x00000000070381c0ULL, 0x00000ULL },
+    { 0x0000e07038000000ULL, 0x00000ULL },
+    { 0x00070381c0000000ULL, 0x00000ULL },
+    { 0x00381c0e00000000ULL, 0x00000ULL },
+    { 0x81c0000000000000ULL, 0x00703ULL },
+    { 0x0e00000000000000ULL, 0x0381cULL },
+    { 0x7000000000000000ULL, 0x1c0e0ULL },
+};
+
+static inline int ctz64(uint64_t x)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static inline int popcount64(uint64_t x)
+{
+#ifdef __GNUC__
+    return __builtin_popcountll(x);
+#else
+    int n = 0;
+    for (; x; x &= x - 1)
+        n++;
+    return n;
+#endif
+}
+
+static inline bb_t bb_and(bb_t a, bb_t b)
+{
+    bb_t r = { a.lo & b.lo, a.hi & b.hi };
+    return r;
+}
+
+static inline bb_t bb_or(bb_t a, bb_t b)
+{
+    bb_t r = { a.lo | b.lo, a.hi | b.hi };
+    return r;
+}
+
+static inline bb_t bb_xor(bb_t a, bb_t b)
+{
+    bb_t r = { a.lo ^ b.lo, a.hi ^ b.hi };
+    return r;
+}
+
+// a & ~b
+static inline bb_t bb_andnot(bb_t a, bb_t b)
+{
+    bb_t r = { a.lo & ~b.lo, a.hi & ~b.hi };
+    return r;
+}
+
+static inline int bb_count(bb_t b)
+{
+    return popcount64(b.lo) + popcount64(b.hi);
+}
+
+static inline bool bb_empty(bb_t b)
+{
+    return (b.lo | b.hi) == 0;
+}
+
+// exactly one bit set
+static inline bool bb_single(bb_t b)
+{
+    if (b.lo)
+        return b.hi == 0 && (b.lo & (b.lo - 1)) == 0;
+    else
+        return b.hi != 0 && (b.hi & (b.hi - 1)) == 0;
+}
+
+static inline int bb_first(bb_t b)
+{
+    return b.lo ? ctz64(b.lo) : 64 + ctz64(b.hi);
+}
+
+static inline bool bb_test(bb_t b, int cell)
+{
+    return cell < 64 ? (b.lo >> cell) & 1 : (b.hi >> (cell - 64)) & 1;
+}
+
+static inline void bb_set(bb_t *b, int cell)
+{
+    if (cell < 64) b->lo |= 1ULL << cell;
+    else b->hi |= 1ULL << (cell - 64);
+}
+
+static inline void bb_clear(bb_t *b, int cell)
+{
+    if (cell < 64) b->lo &= ~(1ULL << cell);
+    else b->hi &= ~(1ULL << (cell - 64));
+}
+
+// Candidates that placing d in cell removes, for the statistics
+static inline int count_eliminated(const struct bb_state *st, int cell, int d,
+                                   bb_t peers)
+{
+    int n = bb_count(bb_and(st->cand[d], peers)) - 1;
+    for (int e=0; e<9; ++e)
+        n += (e != d) && bb_test(st->cand[e], cell);
+    return n;
+}
+
+static inline void place(struct bb_state *st, int cell, int d,
+                         struct solver_stats *stats)
+{
+    int row = cell / 9, col = cell % 9;
+    int box = (row / 3) * 3 + col / 3;
+
+    // remove d from all peers; the unit masks include the cell itself
+    bb_t peers = bb_or(unit_mask[row],
+                       bb_or(unit_mask[9 + col], unit_mask[18 + box]));
+    _stat_add(stats, imposes, 1);
+    _stat_add(stats, eliminations, count_eliminated(st, cell, d, peers));
+    st->cand[d] = bb_andnot(st->cand[d], peers);
+
+    // ... and all other digits from the cell
+    for (int e=0; e<9; ++e)
+        bb_clear(&st->cand[e], cell);
+    bb_set(&st->cand[d], cell);
+
+    bb_clear(&st->unsolved, cell);
+    st->placed[d] |= (1u << row) | (1u << (9 + col)) | (1u << (18 + box));
+}
+
+// Apply naked and hidden singles until nothing changes.
+// Returns false if the position turned out to be contradictory.
+static bool propagate(struct bb_state *st, struct solver_stats *stats)
+{
+    for (;;) {
+        _stat_add(stats, passes, 1);
+
+        // Count candidates per cell (saturating at 2) with bit-sliced adds
+        bb_t once = { 0, 0 }, twice = { 0, 0 };
+        for (int d=0; d<9; ++d) {
+            twice = bb_or(twice, bb_and(once, st->cand[d]));
+            once = bb_or(once, st->cand[d]);
+        }
+
+        if (!bb_empty(bb_andnot(st->unsolved, once)))
+            return false;
+
+        bb_t singles = bb_andnot(st->unsolved, twice);
+        if (!bb_empty(singles)) {
+            do {
+                int cell = bb_first(singles);
+                bb_clear(&singles, cell);
+
+                // an earlier single in this batch may have taken our digit
+                int d;
+                for (d=0; d<9; ++d)
+                    if (bb_test(st->cand[d], cell)) break;
+                if (d == 9)
+                    return false;
+                place(st, cell, d, stats);
+            } while (!bb_empty(singles));
+            continue;
+        }
+
+        // Hidden singles: a unit in which d has only one place left
+        bool placed_any = false;
+        for (int d=0; d<9; ++d) {
+            uint32_t todo = ~st->placed[d] & ALL_UNITS;
+            while (todo) {
+                int u = ctz64(todo);
+                todo &= todo - 1;
+
+                bb_t places = bb_and(st->cand[d], unit_mask[u]);
+                if (bb_empty(places))
+                    return false;
+                if (bb_single(places)) {
+                    place(st, bb_first(places), d, stats);
+                    placed_any = true;
+                    todo &= ~st->placed[d];
+                }
+            }
+        }
+
+        if (!placed_any)
+            return true;
+    }
+}
+
+// The first unsolved cell with the fewest candidates, like _solve_more
+static int choose_cell(const struct bb_state *st)
+{
+    // Per-cell candidate counts as four bit planes
+    bb_t b0 = { 0, 0 }, b1 = { 0, 0 }, b2 = { 0, 0 }, b3 = { 0, 0 };
+    for (int d=0; d<9; ++d) {
+        bb_t x = bb_and(st->cand[d], st->unsolved);
+        bb_t c1 = bb_and(b0, x);
+        b0 = bb_xor(b0, x);
+        bb_t c2 = bb_and(b1, c1);
+        b1 = bb_xor(b1, c1);
+        bb_t c3 = bb_and(b2, c2);
+        b2 = bb_xor(b2, c2);
+        b3 = bb_or(b3, c3);
+    }
+
+    for (int k=2; k<=9; ++k) {
+        bb_t m = st->unsolved;
+        m = (k & 1) ? bb_and(m, b0) : bb_andnot(m, b0);
+        m = (k & 2) ? bb_and(m, b1) : bb_andnot(m, b1);
+        m = (k & 4) ? bb_and(m, b2) : bb_andnot(m, b2);
+        m = (k & 8) ? bb_and(m, b3) : bb_andnot(m, b3);
+        if (!bb_empty(m))
+            return bb_first(m);
+    }
+    return -1;
+}
+
+static bool load_state(struct bb_state *st, sudoku_t s,
+                       struct solver_stats *stats)
+{
+    const field_t *cells = (const field_t *) s;
+
+    memset(st, 0, sizeof(*st));
+    st->unsolved = all_cells;
+
+    for (int c=0; c<81; ++c) {
+        for (int d=0; d<9; ++d) {
+            if ((cells[c] >> d) & 1)
+                bb_set(&st->cand[d], c);
+        }
+    }
+
+    for (int c=0; c<81; ++c) {
+        if (!is_fixed(cells[c])) continue;
+        int d = lowest_bit_index(cells[c]);
+        // two equal givens in one unit
+        if (!bb_test(st->cand[d], c))
+            return false;
+        place(st, c, d, stats);
+    }
+    return true;
+}
+
+static void store_state(const struct bb_state *st, sudoku_t s)
+{
+    field_t *cells = (field_t *) s;
+
+    for (int c=0; c<81; ++c) {
+        field_t f = 0;
+        for (int d=0; d<9; ++d) {
+            if (bb_test(st->cand[d], c))
+                f |= 1 << d;
+        }
+        cells[c] = f;
+    }
+}
+
+static int search(struct bb_search *srch, struct bb_state *st, int depth)
+{
+    if (!propagate(st, srch->stats))
+        return 0;
+
+    if (bb_empty(st->unsolved)) {
+        srch->solution = *st;
+        srch->found++;
+        if (srch->collect != NULL) {
+            sudoku_t s;
+            store_state(st, s);
+            if (!(*srch->collect)(srch->collect_arg, s))
+                srch->stop = true;
+        }
+        if (srch->max_solutions > 0 && srch->found >= srch->max_solutions)
+            srch->stop = true;
+        return 1;
+    }
+
+    int cell = choose_cell(st);
+    int solutions = 0;
+    _stat_max(srch->stats, max_depth, depth + 1);
+
+    for (int d=0; d<9; ++d) {
+        if (!bb_test(st->cand[d], cell)) continue;
+        if (solver_budget_spent(srch->budget)) {
+            srch->stop = true;
+            break;
+        }
+
+        struct bb_state child = *st;
+        place(&child, cell, d, srch->stats);
+        _stat_add(srch->stats, guesses, 1);
+
+        int solutions_here = search(srch, &child, depth + 1);
+        if (solutions_here > 0) {
+            if (!srch->check_unique)
+                return solutions_here;
+            solutions += solutions_here;
+        } else {
+            _stat_add(srch->stats, backtracks, 1);
+        }
+        if (srch->stop)
+            break;
+    }
+
+    return solutions;
+}
+
+int bitboard_solve(sudoku_t s, bool check_unique,
+                   solution_collector collect, void *collect_arg,
+                   const struct solver_options *opts)
+{
+    struct solver_stats scratch_stats = { 0 };
+    struct bb_state st;
+    struct bb_search srch;
+
+    srch.stats = (opts && opts->stats) ? opts->stats : &scratch_stats;
+    srch.check_unique = check_unique;
+    srch.collect = collect;
+    srch.collect_arg = collect_arg;
+    srch.max_solutions = opts ? opts->max_solutions : 0;
+    srch.found = 0;
+    srch.stop = false;
+    srch.budget = opts ? opts->budget : NULL;
+
+    if (!load_state(&st, s, srch.stats))
+        return 0;
+
+    int count = search(&srch, &st, 0);
+    if (count > 0)
+        store_state(&srch.solution, s);
+
+    return count;
+}
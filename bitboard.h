@@ -0,0 +1,10 @@
+#ifndef _SUDOKU_BITBOARD_H
+#define _SUDOKU_BITBOARD_H
+
+#include "solver.h"
+
+int bitboard_solve(sudoku_t s, bool check_unique,
+                   solution_collector collect, void *collect_arg,
+                   const struct solver_options *opts);
+
+#endif /* _SUDOKU_BITBOARD_H */
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include "cache.h"
+
+#define CACHE_INITIAL_SIZE 1024
+// The table never grows past this, about 90 MB
+#define CACHE_MAX_SIZE (2 * CACHE_MAX_ENTRIES)
+
+static uint64_t hash_digits(const sudoku_digits_t d)
+{
+    // FNV-1a; 0 marks free slots
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int c=0; c<81; ++c) {
+        h ^= d[c];
+        h *= 0x100000001b3ULL;
+    }
+    return h ? h : 1;
+}
+
+struct solution_cache *solution_cache_new(void)
+{
+    struct solution_cache *c = malloc(sizeof(struct solution_cache));
+
+    if (c == NULL)
+        return NULL;
+    c->size = CACHE_INITIAL_SIZE;
+    c->used = 0;
+    c->entries = calloc(c->size, sizeof(struct cache_entry));
+    if (c->entries == NULL) {
+        free(c);
+        return NULL;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    c->hits = c->misses = 0;
+    return c;
+}
+
+void solution_cache_free(struct solution_cache *c)
+{
+    pthread_mutex_destroy(&c->lock);
+    free(c->entries);
+    free(c);
+}
+
+static struct cache_entry *find_slot(struct cache_entry *entries, size_t size,
+                                     uint64_t h, const sudoku_digits_t puzzle)
+{
+    size_t i = h & (size - 1);
+
+    while (entries[i].hash != 0) {
+        if (entries[i].hash == h
+                && memcmp(entries[i].puzzle, puzzle, sizeof(sudoku_digits_t)) == 0)
+            break;
+        i = (i + 1) & (size - 1);
+    }
+    return &entries[i];
+}
+
+// Double the table; false if it is as large as it gets or there is no
+// memory for more
+static bool grow(struct solution_cache *c)
+{
+    size_t size = 2 * c->size;
+    struct cache_entry *entries;
+
+    if (size > CACHE_MAX_SIZE)
+        return false;
+    entries = calloc(size, sizeof(struct cache_entry));
+    if (entries == NULL)
+        return false;
+
+    for (size_t i=0; i<c->size; ++i) {
+        struct cache_entry *e = &c->entries[i];
+        if (e->hash != 0)
+            *find_slot(entries, size, e->hash, e->puzzle) = *e;
+    }
+    free(c->entries);
+    c->entries = entries;
+    c->size = size;
+    return true;
+}
+
+bool solution_cache_lookup(struct solution_cache *c, const sudoku_digits_t puzzle,
+                           sudoku_digits_t solution, int *count)
+{
+    uint64_t h = hash_digits(puzzle);
+    bool found;
+
+    pthread_mutex_lock(&c->lock);
+    struct cache_entry *e = find_slot(c->entries, c->size, h, puzzle);
+    found = e->hash != 0;
+    if (found) {
+        memcpy(solution, e->solution, sizeof(sudoku_digits_t));
+        *count = e->count;
+        c->hits++;
+    } else {
+        c->misses++;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return found;
+}
+
+bool solution_cache_insert(struct solution_cache *c, const sudoku_digits_t puzzle,
+                           const sudoku_digits_t solution, int count)
+{
+    uint64_t h = hash_digits(puzzle);
+
+    pthread_mutex_lock(&c->lock);
+    struct cache_entry *e = find_slot(c->entries, c->size, h, puzzle);
+    if (e->hash == 0) {
+        if (2 * (c->used + 1) > c->size) {
+            if (!grow(c)) {
+                pthread_mutex_unlock(&c->lock);
+                return false;
+            }
+            e = find_slot(c->entries, c->size, h, puzzle);
+        }
+        e->hash = h;
+        memcpy(e->puzzle, puzzle, sizeof(sudoku_digits_t));
+        c->used++;
+    }
+    memcpy(e->solution, solution, sizeof(sudoku_digits_t));
+    e->count = count;
+    pthread_mutex_unlock(&c->lock);
+    return true;
+}
+
+static void format_digits(char *buf, const sudoku_digits_t d)
+{
+    for (int c=0; c<81; ++c)
+        buf[c] = d[c] ? '0' + d[c] : '.';
+    buf[81] = '\0';
+}
+
+static bool parse_digits(const char *buf, sudoku_digits_t d)
+{
+    for (int c=0; c<81; ++c) {
+        if (buf[c] == '.')
+            d[c] = 0;
+        else if (buf[c] >= '1' && buf[c] <= '9')
+            d[c] = buf[c] - '0';
+        else
+            return false;
+    }
+    return buf[81] == '\0';
+}
+
+int solution_cache_load(struct solution_cache *c, FILE *fp)
+{
+    char puzzle[82], solution[82];
+    sudoku_digits_t p, s;
+    int count, n = 0;
+
+    while (fscanf(fp, "%81s %81s %d", puzzle, solution, &count) == 3) {
+        if (!parse_digits(puzzle, p))
+            break;
+        if (!parse_digits(solution, s))
+            memset(s, 0, sizeof(s));
+        if (!solution_cache_insert(c, p, s, count))
+            break;
+        n++;
+    }
+    return n;
+}
+
+void solution_cache_save(struct solution_cache *c, FILE *fp)
+{
+    char puzzle[82], solution[82];
+
+    pthread_mutex_lock(&c->lock);
+    for (size_t i=0; i<c->size; ++i) {
+        struct cache_entry *e = &c->entries[i];
+        if (e->hash == 0)
+            continue;
+        format_digits(puzzle, e->puzzle);
+        if (e->count == 0)
+            strcpy(solution, "-");
+        else
+            format_digits(solution, e->solution);
+        fprintf(fp, "%s %s %d\n", puzzle, solution, e->count);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,45 @@
+#ifndef _SUDOKU_CACHE_H
+#define _SUDOKU_CACHE_H
+
+#include <pthread.h>
+#include "canon.h"
+
+// Count of an entry whose puzzle was solved but not counted
+#define CACHE_NOT_COUNTED -1
+
+struct cache_entry {
+    uint64_t hash;              // 0: free slot
+    sudoku_digits_t puzzle;
+    sudoku_digits_t solution;
+    int count;                  // 0: no solution
+};
+
+// Puzzle to solution map, safe to share between threads. Open addressing
+// with linear probing, kept at most half full.
+// Entries are never evicted; once CACHE_MAX_ENTRIES are in, new puzzles
+// are not cached any more.
+#define CACHE_MAX_ENTRIES (1 << 18)
+
+struct solution_cache {
+    pthread_mutex_t lock;
+    struct cache_entry *entries;
+    size_t size, used;
+    unsigned long hits, misses;
+};
+
+// NULL if there is no memory for it
+struct solution_cache *solution_cache_new(void);
+void solution_cache_free(struct solution_cache *c);
+
+bool solution_cache_lookup(struct solution_cache *c, const sudoku_digits_t puzzle,
+                           sudoku_digits_t solution, int *count);
+// false if the puzzle could not be added: the cache is full, or there is
+// no memory to grow it
+bool solution_cache_insert(struct solution_cache *c, const sudoku_digits_t puzzle,
+                           const sudoku_digits_t solution, int count);
+
+// One line per entry: puzzle, solution ('-' if none) and count
+int solution_cache_load(struct solution_cache *c, FILE *fp);
+void solution_cache_save(struct solution_cache *c, FILE *fp);
+
+#endif /* _SUDOKU_CACHE_H */
@@ -0,0 +1,257 @@
+#include "canon.h"
+
+/*
+ * Canonical form under the 2 * 6^8 geometric symmetries and the relabelling
+ * of digits. For a fixed geometric symmetry, the smallest relabelling
+ * numbers the digits in order of first appearance, so the label of a cell
+ * only depends on the cells before it.
+ *
+ * The first row of the canonical form only depends on where its empty
+ * cells are, so only the input rows and column maps that put the most
+ * empty cells first are tried. For each of those the other rows are chosen
+ * one at a time, and a row order is dropped as soon as its prefix is
+ * bigger than the best string found so far.
+ */
+
+struct canon_search {
+    uint8_t g[9][9];            // input digits, transposed or not
+    bool transpose;
+    uint8_t col[9];             // current column map
+    uint8_t row[9];             // current row order
+    int first_row;              // input row that becomes row 0
+    sudoku_digits_t best;
+    int best_len;               // rows of best that are valid
+    struct sudoku_transform best_t;
+};
+
+static const uint8_t perms3[6][3] = {
+    { 0, 1, 2 }, { 0, 2, 1 }, { 1, 0, 2 },
+    { 1, 2, 0 }, { 2, 0, 1 }, { 2, 1, 0 }
+};
+
+static inline int digit_of(field_t f)
+{
+    return is_fixed(f) ? lowest_bit_index(f) + 1 : 0;
+}
+
+// Choose output row r. label and next_label are the relabelling so far,
+// used_bands/used_rows the input rows taken, and written tells whether
+// the current path has already replaced the best prefix.
+static void canon_rows(struct canon_search *cs, int r, const uint8_t *label,
+                       int next_label, int used_bands, int used_rows,
+                       bool written)
+{
+    if (r == 9) {
+        if (written) {
+            cs->best_t.transpose = cs->transpose;
+            memcpy(cs->best_t.row, cs->row, 9);
+            memcpy(cs->best_t.col, cs->col, 9);
+            memcpy(cs->best_t.label, label, 10);
+        }
+        return;
+    }
+
+    int first_band, last_band;
+    if (r % 3 == 0) {
+        first_band = 0;
+        last_band = 2;
+    } else {
+        first_band = last_band = cs->row[r - 1] / 3;
+    }
+
+    for (int b=first_band; b<=last_band; ++b) {
+        if (r % 3 == 0 && (used_bands >> b) & 1) continue;
+        for (int k=3*b; k<3*b+3; ++k) {
+            if ((used_rows >> k) & 1) continue;
+            if (r == 0 && k != cs->first_row) continue;
+
+            uint8_t my_label[10], out[9];
+            int my_next = next_label;
+            memcpy(my_label, label, 10);
+            for (int c=0; c<9; ++c) {
+                int d = cs->g[k][cs->col[c]];
+                if (d && !my_label[d])
+                    my_label[d] = ++my_next;
+                out[c] = my_label[d];
+            }
+
+            // The prefix so far equals the best one, compare this row
+            bool better = cs->best_len <= r;
+            if (!better) {
+                int cmp = memcmp(out, cs->best + 9 * r, 9);
+                if (cmp > 0)
+                    continue;
+                better = cmp < 0;
+            }
+            if (better) {
+                memcpy(cs->best + 9 * r, out, 9);
+                cs->best_len = r + 1;
+            }
+
+            cs->row[r] = k;
+            canon_rows(cs, r + 1, my_label, my_next, used_bands | (1 << b),
+                       used_rows | (1 << k), written || better);
+        }
+    }
+}
+
+// Digits the puzzle does not use get the labels left over, so that the
+// relabelling stays a permutation.
+static void complete_labels(uint8_t label[10])
+{
+    int used = 0, next = 1;
+
+    for (int d=1; d<=9; ++d)
+        if (label[d])
+            used |= 1 << label[d];
+    for (int d=1; d<=9; ++d) {
+        if (label[d]) continue;
+        while ((used >> next) & 1)
+            next++;
+        label[d] = next++;
+    }
+}
+
+// Given cells of input row k in stack st, as bits 0..2
+static inline int stack_givens(struct canon_search *cs, int k, int st)
+{
+    return (cs->g[k][3 * st] != 0) | (cs->g[k][3 * st + 1] != 0) << 1
+           | (cs->g[k][3 * st + 2] != 0) << 2;
+}
+
+// The pattern of givens row k has when its empty cells are moved to the
+// front, as a number that compares like the row would
+static int row_key(struct canon_search *cs, int k)
+{
+    int counts[3], key = 0;
+
+    for (int st=0; st<3; ++st)
+        counts[st] = count_bits(stack_givens(cs, k, st));
+    // stacks with fewer givens first, empty cells first in each stack
+    for (int n=0; n<=3; ++n)
+        for (int st=0; st<3; ++st)
+            if (counts[st] == n)
+                key = (key << 3) | ((1 << n) - 1);
+    return key;
+}
+
+// Is perm a permutation that moves the empty cells (or the stacks with
+// fewer givens) to the front?
+static inline bool front_loaded(const uint8_t *perm, const int *weight)
+{
+    return weight[perm[0]] <= weight[perm[1]]
+           && weight[perm[1]] <= weight[perm[2]];
+}
+
+// Try every column map that gives row k the pattern of row_key
+static void canon_first_row(struct canon_search *cs, const uint8_t *label)
+{
+    int k = cs->first_row, counts[3], given[3][3];
+
+    for (int st=0; st<3; ++st) {
+        int bits = stack_givens(cs, k, st);
+        counts[st] = count_bits(bits);
+        for (int c=0; c<3; ++c)
+            given[st][c] = (bits >> c) & 1;
+    }
+
+    for (int sp=0; sp<6; ++sp) {
+        if (!front_loaded(perms3[sp], counts)) continue;
+        const uint8_t *stacks = perms3[sp];
+        for (int p0=0; p0<6; ++p0) {
+            if (!front_loaded(perms3[p0], given[stacks[0]])) continue;
+            for (int p1=0; p1<6; ++p1) {
+                if (!front_loaded(perms3[p1], given[stacks[1]])) continue;
+                for (int p2=0; p2<6; ++p2) {
+                    if (!front_loaded(perms3[p2], given[stacks[2]])) continue;
+                    const int p[3] = { p0, p1, p2 };
+                    for (int c=0; c<9; ++c)
+                        cs->col[c] = 3 * stacks[c / 3] + perms3[p[c / 3]][c % 3];
+                    canon_rows(cs, 0, label, 0, 0, 0, false);
+                }
+            }
+        }
+    }
+}
+
+void canonicalize_sudoku(sudoku_t s, sudoku_digits_t canon,
+                         struct sudoku_transform *t)
+{
+    struct canon_search cs;
+    uint8_t label[10];
+    int keys[2][9], best_key = 1 << 30;
+
+    cs.best_len = 0;
+    memset(label, 0, sizeof(label));
+
+    for (int pass=0; pass<2; ++pass) {
+        for (int tr=0; tr<2; ++tr) {
+            cs.transpose = tr;
+            for (int i=0; i<9; ++i)
+                for (int j=0; j<9; ++j)
+                    cs.g[i][j] = digit_of(tr ? s[j][i] : s[i][j]);
+
+            for (int k=0; k<9; ++k) {
+                if (pass == 0) {
+                    keys[tr][k] = row_key(&cs, k);
+                    if (keys[tr][k] < best_key)
+                        best_key = keys[tr][k];
+                } else if (keys[tr][k] == best_key) {
+                    cs.first_row = k;
+                    canon_first_row(&cs, label);
+                }
+            }
+        }
+    }
+
+    memcpy(canon, cs.best, sizeof(sudoku_digits_t));
+    complete_labels(cs.best_t.label);
+    if (t)
+        *t = cs.best_t;
+}
+
+void sudoku_to_digits(sudoku_t s, sudoku_digits_t d)
+{
+    for (int c=0; c<81; ++c)
+        d[c] = digit_of(s[c / 9][c % 9]);
+}
+
+void digits_to_sudoku(const sudoku_digits_t d, sudoku_t s)
+{
+    for (int c=0; c<81; ++c)
+        s[c / 9][c % 9] = d[c] ? 1 << (d[c] - 1) : 0x1ff;
+}
+
+void apply_transform(sudoku_t s, const struct sudoku_transform *t,
+                     sudoku_t out)
+{
+    for (int r=0; r<9; ++r) {
+        for (int c=0; c<9; ++c) {
+            int i = t->row[r], j = t->col[c];
+            int d = digit_of(t->transpose ? s[j][i] : s[i][j]);
+            out[r][c] = d ? 1 << (t->label[d] - 1) : 0x1ff;
+        }
+    }
+}
+
+void undo_transform(sudoku_t out, const struct sudoku_transform *t,
+                    sudoku_t s)
+{
+    uint8_t digit[10];
+
+    digit[0] = 0;
+    for (int d=1; d<=9; ++d)
+        digit[t->label[d]] = d;
+
+    for (int r=0; r<9; ++r) {
+        for (int c=0; c<9; ++c) {
+            int i = t->row[r], j = t->col[c];
+            int d = digit[digit_of(out[r][c])];
+            field_t f = d ? 1 << (d - 1) : 0x1ff;
+            if (t->transpose)
+                s[j][i] = f;
+            else
+                s[i][j] = f;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef _SUDOKU_CANON_H
+#define _SUDOKU_CANON_H
+
+#include "sudoku.h"
+
+// A symmetry of the sudoku: an optional transposition, then a permutation
+// of the rows and columns that keeps bands and stacks together, then a
+// relabelling of the digits.
+struct sudoku_transform {
+    bool transpose;
+    uint8_t row[9];         // output row r is row row[r] of the input
+    uint8_t col[9];         // output column c is column col[c]
+    uint8_t label[10];      // digit d becomes label[d]; 0 (empty) stays 0
+};
+
+// One byte per cell in reading order: 0 for empty, 1 to 9 for a given
+typedef uint8_t sudoku_digits_t[81];
+
+// The smallest digit string any symmetry maps s to, and a symmetry that
+// does. Isomorphic puzzles share the same canonical form.
+void canonicalize_sudoku(sudoku_t s, sudoku_digits_t canon,
+                         struct sudoku_transform *t);
+
+void sudoku_to_digits(sudoku_t s, sudoku_digits_t d);
+void digits_to_sudoku(const sudoku_digits_t d, sudoku_t s);
+
+// out = t(s) and s = t(out); fixed cells are moved and relabelled,
+// anything else becomes 0x1ff.
+void apply_transform(sudoku_t s, const struct sudoku_transform *t,
+                     sudoku_t out);
+void undo_transform(sudoku_t out, const struct sudoku_transform *t,
+                    sudoku_t s);
+
+#endif /* _SUDOKU_CANON_H */
@@ -0,0 +1,265 @@
+#include "dlx.h"
+
+/*
+ * Sudoku as exact cover, solved with Knuth's dancing links.
+ *
+ * Each of the 729 candidate placements (row, column, digit) is a matrix
+ * row that covers four of the 324 constraints: the cell is filled, and
+ * the digit occurs in the row, in the column and in the box. Nodes live
+ * in plain arrays with 16-bit links, and the four nodes of a matrix row
+ * are consecutive, so walking a row needs no left/right links. The
+ * whole matrix (about 20 KB) is built on the stack for every call.
+ */
+
+#define N_COLUMNS 324
+#define N_ROWS 729
+// Node 0 is the root, nodes 1-324 the column headers
+#define FIRST_ROW_NODE (1 + N_COLUMNS)
+#define N_NODES (FIRST_ROW_NODE + 4 * N_ROWS)
+
+struct dlx {
+    int16_t up[N_NODES], down[N_NODES], column[N_NODES];
+    int16_t left[FIRST_ROW_NODE], right[FIRST_ROW_NODE];   // headers only
+    int16_t size[FIRST_ROW_NODE];
+    bool covered[FIRST_ROW_NODE];
+};
+
+struct dlx_search {
+    struct dlx *x;
+    struct solver_stats *stats;
+    bool check_unique;
+    solution_collector collect;
+    void *collect_arg;
+    int max_solutions;
+    int found;
+    bool stop;
+    struct solver_budget *budget;
+    int n_chosen;
+    int16_t chosen[81];         // matrix rows of the givens and guesses
+    sudoku_t solution;          // the last one found
+};
+
+static inline int row_base(int node)
+{
+    return node - (node - FIRST_ROW_NODE) % 4;
+}
+
+// Unlink the other nodes of node's matrix row from their columns
+static inline void hide_others(struct dlx *x, int node)
+{
+    int base = row_base(node);
+    for (int k=1; k<4; ++k) {
+        int j = base + (node - base + k) % 4;
+        x->down[x->up[j]] = x->down[j];
+        x->up[x->down[j]] = x->up[j];
+        x->size[x->column[j]]--;
+    }
+}
+
+static inline void unhide_others(struct dlx *x, int node)
+{
+    int base = row_base(node);
+    for (int k=3; k>=1; --k) {
+        int j = base + (node - base + k) % 4;
+        x->size[x->column[j]]++;
+        x->down[x->up[j]] = j;
+        x->up[x->down[j]] = j;
+    }
+}
+
+static void cover(struct dlx *x, int c)
+{
+    x->right[x->left[c]] = x->right[c];
+    x->left[x->right[c]] = x->left[c];
+    x->covered[c] = true;
+    for (int i=x->down[c]; i!=c; i=x->down[i])
+        hide_others(x, i);
+}
+
+static void uncover(struct dlx *x, int c)
+{
+    for (int i=x->up[c]; i!=c; i=x->up[i])
+        unhide_others(x, i);
+    x->covered[c] = false;
+    x->right[x->left[c]] = c;
+    x->left[x->right[c]] = c;
+}
+
+static void build(struct dlx *x)
+{
+    for (int c=0; c<FIRST_ROW_NODE; ++c) {
+        x->left[c] = c == 0 ? N_COLUMNS : c - 1;
+        x->right[c] = c == N_COLUMNS ? 0 : c + 1;
+        x->up[c] = x->down[c] = c;
+        x->column[c] = c;
+        x->size[c] = 0;
+        x->covered[c] = false;
+    }
+
+    for (int row=0; row<N_ROWS; ++row) {
+        int cell = row / 9, d = row % 9;
+        int i = cell / 9, j = cell % 9, b = (i / 3) * 3 + j / 3;
+        int columns[4] = {
+            1 + cell, 1 + 81 + i * 9 + d, 1 + 162 + j * 9 + d,
+            1 + 243 + b * 9 + d
+        };
+
+        for (int k=0; k<4; ++k) {
+            int node = FIRST_ROW_NODE + 4 * row + k, c = columns[k];
+            x->column[node] = c;
+            x->up[node] = x->up[c];
+            x->down[node] = c;
+            x->down[x->up[c]] = node;
+            x->up[c] = node;
+            x->size[c]++;
+        }
+    }
+}
+
+// Take matrix row into the solution for good. False if it clashes with
+// one taken before.
+static bool take_row(struct dlx_search *srch, int row)
+{
+    struct dlx *x = srch->x;
+    int base = FIRST_ROW_NODE + 4 * row;
+
+    for (int k=0; k<4; ++k) {
+        if (x->covered[x->column[base + k]])
+            return false;
+    }
+    for (int k=0; k<4; ++k)
+        cover(x, x->column[base + k]);
+    srch->chosen[srch->n_chosen++] = row;
+    return true;
+}
+
+// Load the candidates of s: rows for excluded digits are dropped, and
+// cells with a single candidate are taken. False if s is contradictory.
+static bool load(struct dlx_search *srch, sudoku_t s)
+{
+    struct dlx *x = srch->x;
+
+    for (int cell=0; cell<81; ++cell) {
+        field_t f = s[cell / 9][cell % 9];
+        for (int d=0; d<9; ++d) {
+            if ((f >> d) & 1)
+                continue;
+            int node = FIRST_ROW_NODE + 4 * (cell * 9 + d);
+            hide_others(x, node);
+            x->down[x->up[node]] = x->down[node];
+            x->up[x->down[node]] = x->up[node];
+            x->size[x->column[node]]--;
+        }
+    }
+
+    for (int cell=0; cell<81; ++cell) {
+        field_t f = s[cell / 9][cell % 9];
+        if (is_fixed(f)
+                && !take_row(srch, cell * 9 + lowest_bit_index(f))) {
+            _stat_add(srch->stats, backtracks, 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void store_solution(struct dlx_search *srch, sudoku_t s)
+{
+    for (int k=0; k<srch->n_chosen; ++k) {
+        int cell = srch->chosen[k] / 9, d = srch->chosen[k] % 9;
+        s[cell / 9][cell % 9] = 1 << d;
+    }
+}
+
+static int search(struct dlx_search *srch, int depth)
+{
+    struct dlx *x = srch->x;
+
+    if (x->right[0] == 0) {
+        store_solution(srch, srch->solution);
+        srch->found++;
+        if (srch->collect != NULL
+                && !(*srch->collect)(srch->collect_arg, srch->solution))
+            srch->stop = true;
+        if (srch->max_solutions > 0 && srch->found >= srch->max_solutions)
+            srch->stop = true;
+        return 1;
+    }
+
+    // The constraint with the fewest ways left to satisfy it
+    int c = x->right[0];
+    for (int j=x->right[c]; j!=0 && x->size[c]>1; j=x->right[j]) {
+        if (x->size[j] < x->size[c])
+            c = j;
+    }
+    if (x->size[c] == 0)
+        return 0;
+
+    bool branching = x->size[c] > 1;
+    int solutions = 0;
+
+    if (branching)
+        _stat_max(srch->stats, max_depth, depth + 1);
+    cover(x, c);
+    for (int r=x->down[c]; r!=c; r=x->down[r]) {
+        if (branching && solver_budget_spent(srch->budget)) {
+            srch->stop = true;
+            break;
+        }
+        int base = row_base(r);
+        for (int k=1; k<4; ++k)
+            cover(x, x->column[base + (r - base + k) % 4]);
+        srch->chosen[srch->n_chosen++] = (r - FIRST_ROW_NODE) / 4;
+        _stat_add(srch->stats, imposes, 1);
+        _stat_add(srch->stats, guesses, branching);
+
+        int solutions_here = search(srch, depth + branching);
+
+        srch->n_chosen--;
+        for (int k=3; k>=1; --k)
+            uncover(x, x->column[base + (r - base + k) % 4]);
+
+        if (solutions_here > 0) {
+            if (!srch->check_unique)
+                return solutions_here;
+            solutions += solutions_here;
+        } else {
+            _stat_add(srch->stats, backtracks, branching);
+        }
+        if (srch->stop)
+            break;
+    }
+    uncover(x, c);
+
+    return solutions;
+}
+
+int dlx_solve(sudoku_t s, bool check_unique,
+              solution_collector collect, void *collect_arg,
+              const struct solver_options *opts)
+{
+    struct solver_stats scratch_stats = { 0 };
+    struct dlx x;
+    struct dlx_search srch;
+
+    srch.x = &x;
+    srch.stats = (opts && opts->stats) ? opts->stats : &scratch_stats;
+    srch.check_unique = check_unique;
+    srch.collect = collect;
+    srch.collect_arg = collect_arg;
+    srch.max_solutions = opts ? opts->max_solutions : 0;
+    srch.found = 0;
+    srch.stop = false;
+    srch.budget = opts ? opts->budget : NULL;
+    srch.n_chosen = 0;
+
+    build(&x);
+    if (!load(&srch, s))
+        return 0;
+
+    int count = search(&srch, 0);
+    if (count > 0)
+        memcpy(s, srch.solution, sizeof(sudoku_t));
+
+    return count;
+}
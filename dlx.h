@@ -0,0 +1,10 @@
+#ifndef _SUDOKU_DLX_H
+#define _SUDOKU_DLX_H
+
+#include "solver.h"
+
+int dlx_solve(sudoku_t s, bool check_unique,
+              solution_collector collect, void *collect_arg,
+              const struct solver_options *opts);
+
+#endif /* _SUDOKU_DLX_H */
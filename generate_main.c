@@ -1,51 +1,194 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "generator.h"
+#include "solver.h"
+#include "grid.h"
 #include <stdlib.h>
 #include <time.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <pthread.h>
+
+static bool short_output = false;
+static bool binary_output = false;
+static uint64_t seed;
+static struct generator_options options;
+static int grid_box = 3;        // --size; 3 takes the 9x9 code
+static bool gave_up = false;    // a puzzle missed the options (atomic)
+
+static long generate_sequential(int n_sudoku);
+static long generate_threaded(int n_sudoku, int n_threads);
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
 int main(int argc, char **argv)
 {
-    bool short_output = false;
+    int n_threads = 0;
+    bool report = false;
+    const char *clues = NULL;
+    long lo, hi;
 
-    srand(time(NULL));
+    seed = time(NULL);
+    options = default_generator_options;
 
     int n_sudoku = 1;
 
     static struct option long_options[] = {
         {"help",              no_argument, 0, 'h'},
         {"short-output",      no_argument, 0, 's'},
-        {"seed",              required_argument, 0, 'S'}
+        {"seed",              required_argument, 0, 'S'},
+        {"threads",           required_argument, 0, 'j'},
+        {"fill",              required_argument, 0, 'f'},
+        {"clues",             required_argument, 0, 'c'},
+        {"symmetry",          required_argument, 0, 'y'},
+        {"difficulty",        required_argument, 0, 'd'},
+        {"report",            no_argument, 0, 'r'},
+        {"binary",            no_argument, 0, 'b'},
+        {"engine",            required_argument, 0, 'e'},
+        {"size",              required_argument, 0, 'n'},
+        {"attempts",          required_argument, 0, 'a'},
+        {0, 0, 0, 0}
     };
 
     int c;
-    while ((c = getopt_long(argc, argv, "hsS:", long_options, NULL))
+    while ((c = getopt_long(argc, argv, "hsS:j:f:c:y:d:rbe:n:a:", long_options, NULL))
                 != -1) {
         switch (c) {
             case 'h':
                 fprintf(stderr,
-                    "Usage: %s [-h] [-s] [-S seed] count\n"
+                    "Usage: %s [-h] [-s] [-b] [-r] [-S seed] [-j threads] [-f fill]\n"
+                    "       [-c clues] [-y symmetry] [-d guesses] [-a attempts] [-e engine]\n"
+                    "       [-n size] count\n"
                     "\n"
                     "Options:\n"
                     "    --help -h\n"
                     "        Display this help message\n"
                     "    --short-output -s\n"
                     "        Use a shorter output format.\n"
+                    "    --binary -b\n"
+                    "        Write a binary corpus (4 bits per cell) to stdout.\n"
                     "    --seed=seed -S seed\n"
-                    "        Initialize the random number generator with seed.\n",
-                    argv[0]);
+                    "        Initialize the random number generator with seed.\n"
+                    "    --threads=N -j N\n"
+                    "        Generate with N threads. The same seed gives the\n"
+                    "        same puzzles with any number of threads.\n"
+                    "    --fill=fill -f fill\n"
+                    "        How to build the completed grid: search (default),\n"
+                    "        shuffle (fastest, from a fixed grid) or solver.\n"
+                    "    --clues=n -c n, --clues=a-b -c a-b\n"
+                    "        Stop removing clues at n (or b) clues, and never go\n"
+                    "        below a. Puzzles that stay above b are rejected.\n"
+                    "    --symmetry=symmetry -y symmetry\n"
+                    "        Clue pattern symmetry: none (default), rotate180,\n"
+                    "        rotate90, mirror or diagonal.\n"
+                    "    --difficulty=a-b -d a-b\n"
+                    "        Only keep puzzles whose search needs between a and b\n"
+                    "        guesses (either end may be left out).\n"
+                    "    --attempts=n -a n\n"
+                    "        Give up, with an error, when n grids in a row fail\n"
+                    "        to give a puzzle within the clue and difficulty\n"
+                    "        ranges (default %d).\n"
+                    "    --engine=engine -e engine\n"
+                    "        Solver engine for the uniqueness checks: bitboard\n"
+                    "        (default), classic, trail or dlx. The puzzles do not\n"
+                    "        depend on it.\n"
+                    "    --size=side -n side\n"
+                    "        Generate grids of this side: 4, 9 (default), 16 or\n"
+                    "        25, with the letters A to P for digits above 9.\n"
+                    "        Not with --binary.\n"
+                    "    --report -r\n"
+                    "        Print the generation rate to stderr.\n",
+                    argv[0], GENERATOR_MAX_ATTEMPTS);
                 return 0;
             case 's':
                 short_output = true;
                 break;
             case 'S':
-                srand(atoi(optarg));
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'j':
+                n_threads = atoi(optarg);
+                break;
+            case 'f':
+                if (!grid_fill_from_name(optarg, &grid_fill)) {
+                    fprintf(stderr, "ERROR: unknown fill %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'c':
+                clues = optarg;
+                break;
+            case 'y':
+                if (!symmetry_from_name(optarg, &options.symmetry)) {
+                    fprintf(stderr, "ERROR: unknown symmetry %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'd':
+                lo = 0;
+                hi = -1;
+                if (!parse_range(optarg, &lo, &hi) || lo < 0
+                        || (hi >= 0 && lo > hi)) {
+                    fprintf(stderr, "ERROR: bad difficulty range %s\n", optarg);
+                    return 2;
+                }
+                options.min_guesses = lo;
+                options.max_guesses = hi;
+                break;
+            case 'a':
+                options.max_attempts = atoi(optarg);
+                if (options.max_attempts <= 0) {
+                    fprintf(stderr, "ERROR: bad attempt count %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'r':
+                report = true;
+                break;
+            case 'b':
+                binary_output = true;
+                break;
+            case 'e':
+                if (!solver_engine_from_name(optarg, &solver_engine)) {
+                    fprintf(stderr, "ERROR: unknown engine %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'n':
+                grid_box = grid_box_from_side(atoi(optarg));
+                if (grid_box == 0) {
+                    fprintf(stderr, "ERROR: no grids of size %s\n", optarg);
+                    return 2;
+                }
                 break;
             default:
                 return 2;
         }
     }
 
+    // The clue range depends on the size
+    if (clues) {
+        int cells = grid_box * grid_box * grid_box * grid_box;
+        lo = 0;
+        hi = cells;
+        if (!parse_range(clues, &lo, &hi) || lo < 0 || hi > cells || lo > hi) {
+            fprintf(stderr, "ERROR: bad clue range %s\n", clues);
+            return 2;
+        }
+        options.min_clues = lo;
+        options.max_clues = hi;
+    }
+
+    if (binary_output && grid_box != 3) {
+        fprintf(stderr, "ERROR: --binary only holds 9x9 grids\n");
+        return 2;
+    }
+
     if ((argc - optind) == 1) {
         n_sudoku = atoi(argv[optind]);
     } else if ((argc - optind) > 1) {
@@ -53,15 +196,218 @@ int main(int argc, char **argv)
         return 2;
     }
 
+    if (binary_output && sudoku_corpus_begin(stdout, 0, n_sudoku) < 0) {
+        perror("ERROR: writing the corpus header");
+        return 1;
+    }
+
+    double t0 = now_s();
+    long attempts;
+    if (n_threads > 1)
+        attempts = generate_threaded(n_sudoku, n_threads);
+    else
+        attempts = generate_sequential(n_sudoku);
+    double dt = now_s() - t0;
+
+    if (gave_up) {
+        fprintf(stderr, "ERROR: no puzzle within the clue and difficulty "
+                        "ranges in %d grids\n",
+                options.max_attempts > 0 ? options.max_attempts
+                                         : GENERATOR_MAX_ATTEMPTS);
+        return 1;
+    }
+    if (report && n_sudoku > 0)
+        fprintf(stderr, "%d puzzles in %.3f s: %.1f puzzles/s, "
+                        "%.3f ms and %.2f grids per puzzle\n",
+                n_sudoku, dt, n_sudoku / dt, 1e3 * dt / n_sudoku,
+                (double) attempts / n_sudoku);
+    return 0;
+}
+
+// generate_and_format for --size
+static int generate_grid_and_format(struct sudoku_rng *rng, long index,
+                                    struct sudoku_writer *out)
+{
+    struct grid g;
+    int attempts = grid_generate(&g, grid_box, rng, &options);
+
+    if (attempts == 0) {
+        __atomic_store_n(&gave_up, true, __ATOMIC_RELAXED);
+        return 0;
+    }
+    if (!short_output && index != 0)
+        sudoku_writer_puts(out, "");
+    sudoku_writer_grid(out, &g, short_output);
+    if (short_output)
+        sudoku_writer_write(out, "\n", 1);
+    return attempts;
+}
+
+// Generate puzzle number index (counting from 0) and append it to out.
+// Returns the number of grids that were tried. Once some puzzle missed
+// the options, nothing more is generated and gave_up is set.
+static int generate_and_format(long index, struct sudoku_writer *out)
+{
+    struct sudoku_rng rng;
     sudoku_t s;
-    
-    for (int i=0; i<n_sudoku; ++i) {
-        if (!short_output && i != 0) {
-            puts("");
+
+    if (__atomic_load_n(&gave_up, __ATOMIC_RELAXED))
+        return 0;
+    sudoku_rng_seed(&rng, seed, index);
+    if (grid_box != 3)
+        return generate_grid_and_format(&rng, index, out);
+    int attempts = generate_sudoku(s, &rng, &options);
+    if (attempts == 0) {
+        __atomic_store_n(&gave_up, true, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    if (binary_output) {
+        sudoku_writer_record(out, 0, s, NULL, 0);
+        return attempts;
+    }
+    if (!short_output && index != 0)
+        sudoku_writer_puts(out, "");
+    sudoku_writer_sudoku(out, s, short_output);
+    if (short_output)
+        sudoku_writer_write(out, "\n", 1);
+    return attempts;
+}
+
+static long generate_sequential(int n_sudoku)
+{
+    struct sudoku_writer out;
+    bool interactive = isatty(fileno(stdout));
+    long attempts = 0;
+
+    sudoku_writer_init(&out, stdout);
+    for (int i=0; i<n_sudoku && !gave_up; ++i) {
+        attempts += generate_and_format(i, &out);
+        if (interactive)
+            sudoku_writer_flush(&out);
+        else
+            sudoku_writer_poll(&out);
+    }
+    sudoku_writer_flush(&out);
+    sudoku_writer_free(&out);
+    return attempts;
+}
+
+/*
+ * Threaded mode: workers claim batches of consecutive puzzle numbers and
+ * format them into the batch's buffer; the main thread prints the batches
+ * in order.
+ */
+
+#define BATCH_SIZE 16
+
+struct batch {
+    struct sudoku_writer out;
+    long attempts;
+    bool done;
+};
+
+struct generator_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct batch *ring;
+    int ring_size;
+    long n_batches;
+    long n_claimed;     // batches taken by a worker
+    long n_written;     // batches printed
+    int n_sudoku;
+};
+
+static void *generator_thread(void *arg)
+{
+    struct generator_pool *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        // Do not run more than a ring ahead of the output
+        while (p->n_claimed < p->n_batches
+               && p->n_claimed - p->n_written >= p->ring_size)
+            pthread_cond_wait(&p->changed, &p->lock);
+        if (p->n_claimed == p->n_batches)
+            break;
+
+        long k = p->n_claimed++;
+        struct batch *b = &p->ring[k % p->ring_size];
+        pthread_mutex_unlock(&p->lock);
+
+        long first = k * BATCH_SIZE;
+        long last = first + BATCH_SIZE;
+        if (last > p->n_sudoku)
+            last = p->n_sudoku;
+
+        b->out.len = 0;
+        b->attempts = 0;
+        for (long i=first; i<last; ++i)
+            b->attempts += generate_and_format(i, &b->out);
+
+        pthread_mutex_lock(&p->lock);
+        b->done = true;
+        pthread_cond_broadcast(&p->changed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static long generate_threaded(int n_sudoku, int n_threads)
+{
+    struct generator_pool p;
+    pthread_t workers[n_threads];
+    struct sudoku_writer out;
+    long attempts = 0;
+
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.changed, NULL);
+    p.ring_size = 4 * n_threads;
+    p.ring = calloc(p.ring_size, sizeof(struct batch));
+    for (int i=0; i<p.ring_size; ++i)
+        sudoku_writer_init(&p.ring[i].out, NULL);
+    p.n_sudoku = n_sudoku;
+    p.n_batches = (n_sudoku + BATCH_SIZE - 1) / BATCH_SIZE;
+    p.n_claimed = p.n_written = 0;
+
+    sudoku_writer_init(&out, stdout);
+
+    for (int i=0; i<n_threads; ++i)
+        pthread_create(&workers[i], NULL, generator_thread, &p);
+
+    pthread_mutex_lock(&p.lock);
+    while (p.n_written < p.n_batches) {
+        struct batch *b = &p.ring[p.n_written % p.ring_size];
+        if (!b->done) {
+            // Nothing to print right now: pass on what we have
+            pthread_mutex_unlock(&p.lock);
+            sudoku_writer_flush(&out);
+            pthread_mutex_lock(&p.lock);
         }
-        generate_sudoku(s);
-        print_sudoku(s, short_output);
-        if(short_output) puts("");
+        while (!b->done)
+            pthread_cond_wait(&p.changed, &p.lock);
+        pthread_mutex_unlock(&p.lock);
+
+        sudoku_writer_write(&out, b->out.buf, b->out.len);
+        sudoku_writer_poll(&out);
+        attempts += b->attempts;
+
+        pthread_mutex_lock(&p.lock);
+        b->done = false;
+        p.n_written++;
+        pthread_cond_broadcast(&p.changed);
     }
-    return 0;
-}
\ No newline at end of file
+    pthread_mutex_unlock(&p.lock);
+
+    for (int i=0; i<n_threads; ++i)
+        pthread_join(workers[i], NULL);
+
+    sudoku_writer_flush(&out);
+    sudoku_writer_free(&out);
+    for (int i=0; i<p.ring_size; ++i)
+        sudoku_writer_free(&p.ring[i].out);
+    free(p.ring);
+    pthread_cond_destroy(&p.changed);
+    pthread_mutex_destroy(&p.lock);
+    return attempts;
+}
@@ -3,19 +3,144 @@
 
 #include <stdlib.h>
 
-static inline field_t random_allowed(field_t current)
+static inline field_t random_allowed(field_t current, struct sudoku_rng *rng)
 {
     for(;;) {
-        field_t trial = 1 << (rand() % 9);
+        field_t trial = 1 << sudoku_rng_below(rng, 9);
         // Is this allowed?
         if ((current & trial) != 0)
             return trial;
     }
 }
 
-static bool remove_random(sudoku_t s);
+enum grid_fill grid_fill = FILL_SEARCH;
 
-void generate_sudoku(sudoku_t buffer)
+bool grid_fill_from_name(const char *name, enum grid_fill *fill)
+{
+    if (strcmp(name, "search") == 0) {
+        *fill = FILL_SEARCH;
+    } else if (strcmp(name, "shuffle") == 0) {
+        *fill = FILL_SHUFFLE;
+    } else if (strcmp(name, "solver") == 0) {
+        *fill = FILL_SOLVER;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void shuffle_ints(int *a, int n, struct sudoku_rng *rng)
+{
+    for (int i=n-1; i>0; --i) {
+        int k = sudoku_rng_below(rng, i + 1);
+        int t = a[i];
+        a[i] = a[k];
+        a[k] = t;
+    }
+}
+
+// Digits used so far per row, column and box
+struct fill_state {
+    int8_t digit[81];
+    uint16_t row[9], col[9], box[9];
+};
+
+// Fill the remaining cells, always branching on a cell with the fewest
+// options and trying them in random order.
+static bool fill_search(struct fill_state *fs, int n_empty,
+                        struct sudoku_rng *rng)
+{
+    if (n_empty == 0)
+        return true;
+
+    int best = -1, best_count = 10;
+    uint16_t best_options = 0;
+    for (int c=0; c<81 && best_count > 1; ++c) {
+        if (fs->digit[c] >= 0) continue;
+        int r = c / 9, k = c % 9, b = (r / 3) * 3 + k / 3;
+        uint16_t options = ~(fs->row[r] | fs->col[k] | fs->box[b]) & 0x1ff;
+        int count = count_bits(options);
+        if (count < best_count) {
+            best = c;
+            best_count = count;
+            best_options = options;
+        }
+    }
+    if (best_count == 0)
+        return false;
+
+    int digits[9], n = 0;
+    for (int d=0; d<9; ++d)
+        if ((best_options >> d) & 1)
+            digits[n++] = d;
+    shuffle_ints(digits, n, rng);
+
+    int r = best / 9, k = best % 9, b = (r / 3) * 3 + k / 3;
+    for (int i=0; i<n; ++i) {
+        uint16_t bit = 1 << digits[i];
+        fs->digit[best] = digits[i];
+        fs->row[r] |= bit;
+        fs->col[k] |= bit;
+        fs->box[b] |= bit;
+        if (fill_search(fs, n_empty - 1, rng))
+            return true;
+        fs->row[r] &= ~bit;
+        fs->col[k] &= ~bit;
+        fs->box[b] &= ~bit;
+    }
+    fs->digit[best] = -1;
+    return false;
+}
+
+static void fill_by_search(sudoku_t buffer, struct sudoku_rng *rng)
+{
+    struct fill_state fs;
+
+    memset(&fs, 0, sizeof(fs));
+    memset(fs.digit, -1, sizeof(fs.digit));
+    fill_search(&fs, 81, rng);
+
+    for (int c=0; c<81; ++c)
+        buffer[c / 9][c % 9] = 1 << fs.digit[c];
+}
+
+// Relabel the digits and permute rows within bands, bands, columns
+// within stacks and stacks of a fixed grid, then maybe transpose it.
+static void fill_by_shuffle(sudoku_t buffer, struct sudoku_rng *rng)
+{
+    int digits[9], rows[9], cols[9], bands[3], stacks[3];
+
+    for (int i=0; i<9; ++i)
+        digits[i] = rows[i] = cols[i] = i;
+    for (int i=0; i<3; ++i)
+        bands[i] = stacks[i] = i;
+
+    shuffle_ints(digits, 9, rng);
+    shuffle_ints(bands, 3, rng);
+    shuffle_ints(stacks, 3, rng);
+    for (int i=0; i<3; ++i) {
+        shuffle_ints(rows + 3 * i, 3, rng);
+        shuffle_ints(cols + 3 * i, 3, rng);
+    }
+    bool transpose = sudoku_rng_below(rng, 2);
+
+    for (int i=0; i<9; ++i) {
+        for (int j=0; j<9; ++j) {
+            int r = 3 * bands[i / 3] + rows[3 * (i / 3) + i % 3] % 3;
+            int c = 3 * stacks[j / 3] + cols[3 * (j / 3) + j % 3] % 3;
+            if (transpose) {
+                int t = r;
+                r = c;
+                c = t;
+            }
+            // the standard pattern grid
+            int d = (3 * r + r / 3 + c) % 9;
+            buffer[i][j] = 1 << digits[d];
+        }
+    }
+}
+
+static void fill_by_solver(sudoku_t buffer, struct sudoku_rng *rng)
 {
     int i, j;
     sudoku_t solve_buffer;
@@ -32,7 +157,7 @@ void generate_sudoku(sudoku_t buffer)
             memcpy(prev, buffer, sizeof(sudoku_t));
 
             if (is_fixed(buffer[i][j])) continue;
-            buffer[i][j] = random_allowed(buffer[i][j]);
+            buffer[i][j] = random_allowed(buffer[i][j], rng);
             impose(buffer, i, j, true);
 
             memcpy(solve_buffer, buffer, sizeof(sudoku_t));
@@ -46,53 +171,227 @@ void generate_sudoku(sudoku_t buffer)
             }
         }
     }
+}
 
-    while(remove_random(buffer));
+void generate_full_grid(sudoku_t buffer, struct sudoku_rng *rng)
+{
+    switch (grid_fill) {
+        case FILL_SEARCH:
+            fill_by_search(buffer, rng);
+            break;
+        case FILL_SHUFFLE:
+            fill_by_shuffle(buffer, rng);
+            break;
+        case FILL_SOLVER:
+            fill_by_solver(buffer, rng);
+            break;
+    }
 }
 
-static bool remove_random(sudoku_t s)
+bool symmetry_from_name(const char *name, enum symmetry *sym)
 {
-    sudoku_t buffer;
-    sudoku_t solve_buffer;
+    if (strcmp(name, "none") == 0) {
+        *sym = SYM_NONE;
+    } else if (strcmp(name, "rotate180") == 0) {
+        *sym = SYM_ROTATE180;
+    } else if (strcmp(name, "rotate90") == 0) {
+        *sym = SYM_ROTATE90;
+    } else if (strcmp(name, "mirror") == 0) {
+        *sym = SYM_MIRROR;
+    } else if (strcmp(name, "diagonal") == 0) {
+        *sym = SYM_DIAGONAL;
+    } else {
+        return false;
+    }
+    return true;
+}
 
-    int can_remove[9][9];
-    int i, j;
-    int can_remove_count = 0;
+// The cells that must be removed together with cell c
+static int symmetric_cells(int c, enum symmetry sym, int orbit[4])
+{
+    int i = c / 9, j = c % 9;
+    int cand[4], n_cand = 1, n = 0;
 
-    for (i=0; i<9; ++i) {
-        for (j=0; j<9; ++j) {
-            can_remove[i][j] = is_fixed(s[i][j]);
-            if (can_remove[i][j])
-                can_remove_count++;
-        }
+    cand[0] = c;
+    switch (sym) {
+        case SYM_NONE:
+            break;
+        case SYM_ROTATE180:
+            cand[n_cand++] = 9 * (8 - i) + (8 - j);
+            break;
+        case SYM_ROTATE90:
+            cand[n_cand++] = 9 * j + (8 - i);
+            cand[n_cand++] = 9 * (8 - i) + (8 - j);
+            cand[n_cand++] = 9 * (8 - j) + i;
+            break;
+        case SYM_MIRROR:
+            cand[n_cand++] = 9 * i + (8 - j);
+            break;
+        case SYM_DIAGONAL:
+            cand[n_cand++] = 9 * j + i;
+            break;
     }
 
+    for (int k=0; k<n_cand; ++k) {
+        bool seen = false;
+        for (int m=0; m<n; ++m)
+            seen |= orbit[m] == cand[k];
+        if (!seen)
+            orbit[n++] = cand[k];
+    }
+    return n;
+}
 
-    while (can_remove_count > 0) {
-        // find something that I can remove, at random.
-        do {
-            i = rand() % 9;
-            j = rand() % 9;
-        } while(!can_remove[i][j]);
+// Is the known solution still the only one once the cells of the orbit
+// have been cleared in s?
+static bool still_unique(sudoku_t s, sudoku_t solution, const int *orbit,
+                         int n)
+{
+    sudoku_t buffer;
+    bool pinned = true;
 
-        // remove it
+    // The clues in the row, column and box may pin every cell down
+    for (int k=0; k<n && pinned; ++k) {
+        int i = orbit[k] / 9, j = orbit[k] % 9;
+        field_t others = 0;
+        for (int m=0; m<9; ++m) {
+            int bi = 3 * (i / 3) + m / 3, bj = 3 * (j / 3) + m % 3;
+            if (is_fixed(s[i][m])) others |= s[i][m];
+            if (is_fixed(s[m][j])) others |= s[m][j];
+            if (is_fixed(s[bi][bj])) others |= s[bi][bj];
+        }
+        pinned = (others | solution[i][j]) == 0x1ff
+                 && !(others & solution[i][j]);
+    }
+    if (pinned)
+        return true;
+
+    // Any second solution would differ from the known one in one of the
+    // cleared cells, so look for a solution with another digit there.
+    for (int k=0; k<n; ++k) {
+        int i = orbit[k] / 9, j = orbit[k] % 9;
         memcpy(buffer, s, sizeof(sudoku_t));
-        buffer[i][j] = 0x1ff;
-        memcpy(solve_buffer, buffer, sizeof(sudoku_t));
+        buffer[i][j] = 0x1ff & ~solution[i][j];
+        if (solve_sudoku(buffer))
+            return false;
+    }
+    return true;
+}
 
-        // did that work?
-        if (count_sudoku_solutions(solve_buffer) == 1) {
-            // Excellent.
-            memcpy(s, buffer, sizeof(sudoku_t));
-            return true;
+// Remove clues from the uniquely solvable puzzle s, whose solution is
+// known, until no more can go or the clue count is down to
+// opts->max_clues. Every clue (or group of symmetric clues) is tried
+// once, in random order: a clue that cannot be removed now cannot be
+// removed from any smaller puzzle either, so one pass leaves a minimal
+// puzzle. Returns the number of clues left.
+int minimize_sudoku(sudoku_t s, sudoku_t solution, struct sudoku_rng *rng,
+                    const struct generator_options *opts)
+{
+    int cells[81], orbit[4];
+    int clues = 0;
+
+    for (int c=0; c<81; ++c) {
+        cells[c] = c;
+        clues += is_fixed(s[c / 9][c % 9]);
+    }
+    shuffle_ints(cells, 81, rng);
+
+    for (int k=0; k<81 && clues > opts->max_clues; ++k) {
+        int c = cells[k];
+        if (!is_fixed(s[c / 9][c % 9]))
+            continue;
+
+        int n = symmetric_cells(c, opts->symmetry, orbit);
+        if (clues - n < opts->min_clues)
+            continue;
+
+        for (int m=0; m<n; ++m)
+            s[orbit[m] / 9][orbit[m] % 9] = 0x1ff;
+
+        if (still_unique(s, solution, orbit, n)) {
+            clues -= n;
         } else {
-            // No. Try removing something else.
-            can_remove[i][j] = 0;
-            can_remove_count--;
+            for (int m=0; m<n; ++m)
+                s[orbit[m] / 9][orbit[m] % 9] = solution[orbit[m] / 9][orbit[m] % 9];
         }
     }
+    return clues;
+}
 
-    // We exhausted our possibilities without being able to remove anything.
-    // This is the minimal sudoku.
-    return false;
+// The guesses a full search built from propagate_sudoku and choose_guess
+// makes to show that s has no other solution, as a measure of the effort
+// needed to solve it. Close to the guesses of _solve_more, and available
+// without SOLVER_STATS. Every guess is charged to budget (or NULL); once
+// it is spent, the search stops and the count is only a lower bound.
+long rate_difficulty(sudoku_t s, struct solver_budget *budget)
+{
+    sudoku_t buffer, child;
+    long guesses = 0;
+    int gi, gj;
+
+    memcpy(buffer, s, sizeof(sudoku_t));
+    if (propagate_sudoku(buffer) != SUDOKU_IN_PROGRESS)
+        return 0;
+    if (!choose_guess(buffer, &gi, &gj))
+        return 0;
+
+    for (int d=0; d<9; ++d) {
+        if ((buffer[gi][gj] >> d) & 1) {
+            if (solver_budget_spent(budget))
+                break;
+            memcpy(child, buffer, sizeof(sudoku_t));
+            child[gi][gj] = 1 << d;
+            guesses += 1 + rate_difficulty(child, budget);
+        }
+    }
+    return guesses;
+}
+
+const struct generator_options default_generator_options = {
+    0, 0, SYM_NONE, 0, -1, 0
+};
+
+void rating_budget(struct solver_budget *budget,
+                   const struct generator_options *opts)
+{
+    memset(budget, 0, sizeof(*budget));
+    // One guess past the band rejects the puzzle, and reaching the lower
+    // end accepts it, so there is no need to count any further
+    if (opts->max_guesses >= 0)
+        budget->max_nodes = opts->max_guesses + 1;
+    else
+        budget->max_nodes = opts->min_guesses;
+    solver_budget_start(budget);
+}
+
+int generate_sudoku(sudoku_t buffer, struct sudoku_rng *rng,
+                    const struct generator_options *opts)
+{
+    sudoku_t solution;
+    int max_attempts;
+
+    if (opts == NULL)
+        opts = &default_generator_options;
+    max_attempts = opts->max_attempts > 0 ? opts->max_attempts
+                                          : GENERATOR_MAX_ATTEMPTS;
+
+    for (int attempts=1; attempts<=max_attempts; ++attempts) {
+        generate_full_grid(solution, rng);
+        memcpy(buffer, solution, sizeof(sudoku_t));
+        int clues = minimize_sudoku(buffer, solution, rng, opts);
+
+        if (opts->max_clues > 0 && clues > opts->max_clues)
+            continue;
+        if (opts->min_guesses > 0 || opts->max_guesses >= 0) {
+            struct solver_budget budget;
+            rating_budget(&budget, opts);
+            long guesses = rate_difficulty(buffer, &budget);
+            if (guesses < opts->min_guesses)
+                continue;
+            if (opts->max_guesses >= 0 && guesses > opts->max_guesses)
+                continue;
+        }
+        return attempts;
+    }
+    return 0;
 }
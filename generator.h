@@ -2,8 +2,109 @@
 #define _SUDOKU_GENERATOR_H
 
 #include "sudoku.h"
+#include "solver.h"
 
-void generate_sudoku(sudoku_t buffer);
+// xoshiro256** random number generator. Each puzzle gets its own stream,
+// derived from the seed and the puzzle index, so that the output does not
+// depend on how the work is split between threads.
+struct sudoku_rng {
+    uint64_t s[4];
+};
+
+static inline uint64_t _splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline void sudoku_rng_seed(struct sudoku_rng *r, uint64_t seed,
+                                   uint64_t stream)
+{
+    uint64_t x = seed ^ (0xd1342543de82ef95ULL * (stream + 1));
+    for (int i=0; i<4; ++i)
+        r->s[i] = _splitmix64(&x);
+}
+
+static inline uint64_t _rotl64(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t sudoku_rng_next(struct sudoku_rng *r)
+{
+    uint64_t *s = r->s;
+    uint64_t result = _rotl64(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = _rotl64(s[3], 45);
+
+    return result;
+}
+
+// Uniform in [0, n) for small n
+static inline int sudoku_rng_below(struct sudoku_rng *r, int n)
+{
+    return (int) (((sudoku_rng_next(r) >> 32) * (uint64_t) n) >> 32);
+}
+
+enum grid_fill {
+    FILL_SEARCH,    // one randomized backtracking search (default)
+    FILL_SHUFFLE,   // a fixed grid with random symmetries applied
+    FILL_SOLVER     // cell by cell, checking each step with the solver
+};
+
+// How generate_sudoku builds the completed grid
+extern enum grid_fill grid_fill;
+
+bool grid_fill_from_name(const char *name, enum grid_fill *fill);
+
+// Symmetry of the clue pattern
+enum symmetry {
+    SYM_NONE,
+    SYM_ROTATE180,  // half turn about the center
+    SYM_ROTATE90,   // quarter turn about the center
+    SYM_MIRROR,     // left to right
+    SYM_DIAGONAL    // about the main diagonal
+};
+
+bool symmetry_from_name(const char *name, enum symmetry *sym);
+
+// Properties of the generated puzzles
+struct generator_options {
+    int min_clues, max_clues;       // max_clues 0: as few as possible
+    enum symmetry symmetry;
+    long min_guesses, max_guesses;  // rate_difficulty band, max < 0: none
+    int max_attempts;               // grids to try (0: the default below)
+};
+
+// Grids generate_sudoku tries before it decides that no puzzle meets the
+// options, which an impossible clue or difficulty band would otherwise
+// leave it looking for forever
+#define GENERATOR_MAX_ATTEMPTS 10000
+
+extern const struct generator_options default_generator_options;
+
+void generate_full_grid(sudoku_t buffer, struct sudoku_rng *rng);
+int minimize_sudoku(sudoku_t s, sudoku_t solution, struct sudoku_rng *rng,
+                    const struct generator_options *opts);
+long rate_difficulty(sudoku_t s, struct solver_budget *budget);
+
+// Returns the number of grids it took to meet the options (NULL: none),
+// or 0 if none of opts->max_attempts grids did
+int generate_sudoku(sudoku_t buffer, struct sudoku_rng *rng,
+                    const struct generator_options *opts);
+
+// The budget that rates a puzzle just far enough to tell whether it is
+// inside the difficulty band of opts
+void rating_budget(struct solver_budget *budget,
+                   const struct generator_options *opts);
 
 
 #endif /* _SUDOKU_GENERATOR_H */
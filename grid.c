@@ -0,0 +1,194 @@
+#include <ctype.h>
+#include "grid.h"
+
+static void grid_shuffle(int *a, int n, struct sudoku_rng *rng)
+{
+    for (int i=n-1; i>0; --i) {
+        int k = sudoku_rng_below(rng, i + 1);
+        int t = a[i];
+        a[i] = a[k];
+        a[k] = t;
+    }
+}
+
+// The cells that must be cleared together with cell p, as in
+// generator.c's symmetric_cells
+static int grid_symmetric_cells(int p, int side, enum symmetry sym,
+                                int orbit[4])
+{
+    int i = p / side, j = p % side, last = side - 1;
+    int cand[4], n_cand = 1, n = 0;
+
+    cand[0] = p;
+    switch (sym) {
+        case SYM_NONE:
+            break;
+        case SYM_ROTATE180:
+            cand[n_cand++] = side * (last - i) + (last - j);
+            break;
+        case SYM_ROTATE90:
+            cand[n_cand++] = side * j + (last - i);
+            cand[n_cand++] = side * (last - i) + (last - j);
+            cand[n_cand++] = side * (last - j) + i;
+            break;
+        case SYM_MIRROR:
+            cand[n_cand++] = side * i + (last - j);
+            break;
+        case SYM_DIAGONAL:
+            cand[n_cand++] = side * j + i;
+            break;
+    }
+
+    for (int k=0; k<n_cand; ++k) {
+        bool seen = false;
+        for (int m=0; m<n; ++m)
+            seen |= orbit[m] == cand[k];
+        if (!seen)
+            orbit[n++] = cand[k];
+    }
+    return n;
+}
+
+// Uniqueness checks during generation give up after this many guesses
+// and keep the clue. Proving that a sparse 25x25 grid has no second
+// solution can take longer than generating a hundred others.
+#define GRID_UNIQUE_GUESSES 1000
+
+#define BOX 2
+#define FIELD uint8_t
+#include "grid_impl.h"
+#undef BOX
+#undef FIELD
+
+#define BOX 3
+#define FIELD uint16_t
+#include "grid_impl.h"
+#undef BOX
+#undef FIELD
+
+#define BOX 4
+#define FIELD uint16_t
+#include "grid_impl.h"
+#undef BOX
+#undef FIELD
+
+#define BOX 5
+#define FIELD uint32_t
+#include "grid_impl.h"
+#undef BOX
+#undef FIELD
+
+int grid_box_from_side(int side)
+{
+    for (int box=GRID_MIN_BOX; box<=GRID_MAX_BOX; ++box) {
+        if (box * box == side)
+            return box;
+    }
+    return 0;
+}
+
+void grid_clear(struct grid *g, int box)
+{
+    g->box = box;
+    g->side = box * box;
+    for (int p=0; p<g->side * g->side; ++p)
+        g->cells[p] = ((grid_field_t) 1 << g->side) - 1;
+}
+
+static inline int symbol_value(int c, int side)
+{
+    const char *p = strchr(GRID_SYMBOLS, toupper(c));
+
+    if (c == 0 || p == NULL || p - GRID_SYMBOLS >= side)
+        return -1;
+    return p - GRID_SYMBOLS;
+}
+
+int grid_read(struct grid *g, int box, FILE *fp)
+{
+    int c, n = 0;
+
+    grid_clear(g, box);
+    int cells = g->side * g->side;
+
+    while (n < cells && (c = fgetc(fp)) != EOF) {
+        if (isspace(c))
+            continue;
+        int d = symbol_value(c, g->side);
+        if (d >= 0)
+            g->cells[n] = (grid_field_t) 1 << d;
+        n++;
+    }
+    return n;
+}
+
+int grid_format(char *buf, const struct grid *g, bool short_format)
+{
+    char *p = buf;
+
+    for (int i=0; i<g->side; ++i) {
+        for (int j=0; j<g->side; ++j) {
+            *(p++) = grid_cell_char(g->cells[i * g->side + j]);
+            if (!short_format)
+                *(p++) = (j != g->side - 1) ? ' ' : '\n';
+        }
+    }
+    return p - buf;
+}
+
+int grid_check(const struct grid *g)
+{
+    bool any_not_fixed = false;
+
+    for (int p=0; p<g->side * g->side; ++p) {
+        if (g->cells[p] == 0)
+            return SUDOKU_ERROR;
+        else if (!grid_is_fixed(g->cells[p]))
+            any_not_fixed = true;
+    }
+    return any_not_fixed ? SUDOKU_IN_PROGRESS : SUDOKU_DONE;
+}
+
+int grid_solve(struct grid *g, bool check_unique,
+               grid_collector collect, void *collect_arg,
+               const struct solver_options *opts)
+{
+    switch (g->box) {
+        case 2:
+            return grid_solve_2(g, check_unique, collect, collect_arg, opts);
+        case 3:
+            return grid_solve_3(g, check_unique, collect, collect_arg, opts);
+        case 4:
+            return grid_solve_4(g, check_unique, collect, collect_arg, opts);
+        case 5:
+            return grid_solve_5(g, check_unique, collect, collect_arg, opts);
+        default:
+            return 0;
+    }
+}
+
+long grid_rate_difficulty(const struct grid *g, struct solver_budget *budget)
+{
+    switch (g->box) {
+        case 2: return grid_rate_2(g, budget);
+        case 3: return grid_rate_3(g, budget);
+        case 4: return grid_rate_4(g, budget);
+        case 5: return grid_rate_5(g, budget);
+        default: return 0;
+    }
+}
+
+int grid_generate(struct grid *g, int box, struct sudoku_rng *rng,
+                  const struct generator_options *opts)
+{
+    if (opts == NULL)
+        opts = &default_generator_options;
+
+    switch (box) {
+        case 2: return grid_generate_2(g, rng, opts);
+        case 3: return grid_generate_3(g, rng, opts);
+        case 4: return grid_generate_4(g, rng, opts);
+        case 5: return grid_generate_5(g, rng, opts);
+        default: return 0;
+    }
+}
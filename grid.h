@@ -0,0 +1,117 @@
+#ifndef _SUDOKU_GRID_H
+#define _SUDOKU_GRID_H
+
+#include "solver.h"
+#include "generator.h"
+
+// Sudoku of any box size from 2 to 5: grids of side 4, 9, 16 and 25.
+// The code is compiled once per box size (see grid_impl.h), so the side,
+// the unit tables and the width of the candidate masks are constants in
+// each instance. The 9x9 engines in solver.c, bitboard.c and dlx.c are
+// separate and stay the fastest way to solve 9x9 grids.
+#define GRID_MIN_BOX 2
+#define GRID_MAX_BOX 5
+#define GRID_MAX_SIDE (GRID_MAX_BOX * GRID_MAX_BOX)
+#define GRID_MAX_CELLS (GRID_MAX_SIDE * GRID_MAX_SIDE)
+
+// Wide enough for the candidates of a 25x25 grid; bit d stands for the
+// digit d+1.
+typedef uint32_t grid_field_t;
+
+struct grid {
+    int box, side;
+    grid_field_t cells[GRID_MAX_CELLS];     // side * side, row by row
+};
+
+// Called for every solution found; return false to stop the search.
+typedef bool (*grid_collector)(void *p, const struct grid *g);
+
+// Digits beyond 9 are written as letters: A is 10, B is 11 and so on
+// up to P for 25. Reading is not case sensitive, and any other
+// character that is not white space is an empty cell.
+#define GRID_SYMBOLS "123456789ABCDEFGHIJKLMNOP"
+
+// Longest output of grid_format: every cell followed by a space or a
+// newline.
+#define GRID_FORMAT_MAX (2 * GRID_MAX_CELLS)
+
+// Box size of a grid with the given side, or 0 if there is none
+int grid_box_from_side(int side);
+
+// An empty grid (every digit possible everywhere)
+void grid_clear(struct grid *g, int box);
+
+// Read the next side*side cells. Returns how many were read, like
+// fill_sudoku_from_file.
+int grid_read(struct grid *g, int box, FILE *fp);
+
+int grid_format(char *buf, const struct grid *g, bool short_format);
+
+// SUDOKU_DONE, SUDOKU_IN_PROGRESS or SUDOKU_ERROR, like check_solution
+int grid_check(const struct grid *g);
+
+// The same contract as _solve_with: the number of solutions (up to the
+// first one unless check_unique), with g holding the last one found.
+int grid_solve(struct grid *g, bool check_unique,
+               grid_collector collect, void *collect_arg,
+               const struct solver_options *opts);
+
+// The guesses a full search makes to show that g has no second
+// solution, like rate_difficulty, and with the same budget.
+long grid_rate_difficulty(const struct grid *g, struct solver_budget *budget);
+
+// Generate a puzzle with a unique solution, like generate_sudoku, and
+// like it returning 0 if no grid met opts. The clue limits in opts count
+// cells of the larger grid.
+int grid_generate(struct grid *g, int box, struct sudoku_rng *rng,
+                  const struct generator_options *opts);
+
+static inline bool grid_is_fixed(grid_field_t f)
+{
+    return f != 0 && (f & (f - 1)) == 0;
+}
+
+static inline int grid_count_bits(grid_field_t f)
+{
+#ifdef __GNUC__
+    return __builtin_popcount(f);
+#else
+    int count = 0;
+    for (; f; f &= f - 1)
+        count++;
+    return count;
+#endif
+}
+
+static inline int grid_lowest_bit_index(grid_field_t f)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(f);
+#else
+    int n = 0;
+    while (!(f & 1)) {
+        f >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static inline char grid_cell_char(grid_field_t f)
+{
+    if (grid_is_fixed(f))
+        return GRID_SYMBOLS[grid_lowest_bit_index(f)];
+    else if (f == 0)
+        return 'E';     // contradiction
+    else
+        return '.';     // undecided
+}
+
+static inline void sudoku_writer_grid(struct sudoku_writer *w,
+                                      const struct grid *g, bool short_format)
+{
+    sudoku_writer_reserve(w, GRID_FORMAT_MAX);
+    w->len += grid_format(w->buf + w->len, g, short_format);
+}
+
+#endif /* _SUDOKU_GRID_H */
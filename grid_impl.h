@@ -0,0 +1,550 @@
+/*
+ * The grid solver and generator for one box size. grid.c includes this
+ * file once per size, with BOX and FIELD (an unsigned type of at least
+ * BOX*BOX bits) defined; every function gets the box size appended to
+ * its name, e.g. grid_search_4. With the side a constant, the loops over
+ * units unroll and the divisions turn into multiplications.
+ *
+ * The search is the classic engine's: propagate naked and hidden
+ * singles, then branch on a cell with the fewest candidates (or a digit
+ * with fewer places in some unit), copying the grid for every guess.
+ * Newly fixed cells wait on a queue, so only their peers are visited
+ * instead of every cell of the grid.
+ */
+
+#define SIDE (BOX * BOX)
+#define CELLS (SIDE * SIDE)
+#define ALL ((FIELD) (((uint64_t) 1 << SIDE) - 1))
+#define G(name) G_(name, BOX)
+#define G_(name, box) G__(name, box)
+#define G__(name, box) grid_##name##_##box
+
+// Cells fixed since the last elimination. A cell is queued when it
+// becomes fixed, which happens once per propagation.
+struct G(queue) {
+    int n;
+    int16_t cells[CELLS];
+};
+
+struct G(search) {
+    struct solver_stats *stats;
+    bool check_unique;
+    grid_collector collect;
+    void *collect_arg;
+    int max_solutions;
+    int found;
+    bool stop;
+    long guesses;                   // kept even without SOLVER_STATS
+    long max_guesses;               // give up after this many (0: never)
+    bool gave_up;
+    struct solver_budget *budget;   // per-puzzle limit (or NULL)
+    struct sudoku_rng *rng;         // try the candidates in random order
+    struct G(queue) queue;
+    FIELD solution[CELLS];          // the last one found
+    struct grid report;             // what the collector gets to see
+};
+
+// Take bit out of cell p. False if that leaves the cell empty.
+static inline bool G(remove)(FIELD *c, int p, FIELD bit, struct G(queue) *q)
+{
+    FIELD f = c[p];
+
+    if (!(f & bit))
+        return true;
+    f &= ~bit;
+    c[p] = f;
+    if (f & (f - 1))
+        return true;
+    if (f == 0)
+        return false;
+    q->cells[q->n++] = p;
+    return true;
+}
+
+// Remove the digit of the fixed cell p from its peers
+static bool G(eliminate)(FIELD *c, int p, struct G(queue) *q)
+{
+    FIELD bit = c[p];
+    int i = p / SIDE, j = p % SIDE;
+    int bi = i - i % BOX, bj = j - j % BOX;
+
+    for (int k=0; k<SIDE; ++k) {
+        if (k != j && !G(remove)(c, i * SIDE + k, bit, q))
+            return false;
+        if (k != i && !G(remove)(c, k * SIDE + j, bit, q))
+            return false;
+    }
+    // The rest of the box: the cells outside row i and column j
+    for (int r=bi; r<bi+BOX; ++r) {
+        if (r == i)
+            continue;
+        for (int k=bj; k<bj+BOX; ++k) {
+            if (k != j && !G(remove)(c, r * SIDE + k, bit, q))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Fix the digits that only one cell of the unit can take. unit holds
+// the indices of the unit's cells. Returns the number of cells fixed,
+// or -1 on a contradiction.
+static inline int G(unit_singles)(FIELD *c, const int *unit,
+                                  struct G(queue) *q)
+{
+    FIELD once = 0, twice = 0;
+
+    for (int k=0; k<SIDE; ++k) {
+        twice |= once & c[unit[k]];
+        once |= c[unit[k]];
+    }
+    if (once != ALL)
+        return -1;      // a digit has no place left
+
+    FIELD unique = once & ~twice;
+    int fixed = 0;
+    for (int k=0; k<SIDE && unique; ++k) {
+        FIELD f = c[unit[k]] & unique;
+        if (f == 0)
+            continue;
+        unique &= ~f;
+        if (f == c[unit[k]])
+            continue;
+        if (f & (f - 1))
+            return -1;  // two digits that both need this cell
+        c[unit[k]] = f;
+        q->cells[q->n++] = unit[k];
+        fixed++;
+    }
+    return fixed;
+}
+
+static int G(hidden_singles)(FIELD *c, struct G(queue) *q)
+{
+    int unit[SIDE], fixed = 0, n;
+
+    for (int u=0; u<SIDE; ++u) {
+        int bi = (u / BOX) * BOX, bj = (u % BOX) * BOX;
+
+        for (int k=0; k<SIDE; ++k)
+            unit[k] = u * SIDE + k;
+        if ((n = G(unit_singles)(c, unit, q)) < 0)
+            return -1;
+        fixed += n;
+
+        for (int k=0; k<SIDE; ++k)
+            unit[k] = k * SIDE + u;
+        if ((n = G(unit_singles)(c, unit, q)) < 0)
+            return -1;
+        fixed += n;
+
+        for (int k=0; k<SIDE; ++k)
+            unit[k] = (bi + k / BOX) * SIDE + bj + k % BOX;
+        if ((n = G(unit_singles)(c, unit, q)) < 0)
+            return -1;
+        fixed += n;
+    }
+    return fixed;
+}
+
+// Naked and hidden singles until nothing changes, starting with the
+// eliminations of the queued cells. False on a contradiction.
+static bool G(propagate)(FIELD *c, struct G(queue) *q,
+                         struct solver_stats *stats)
+{
+    for (;;) {
+        while (q->n > 0) {
+            _stat_add(stats, imposes, 1);
+            if (!G(eliminate)(c, q->cells[--q->n], q))
+                return false;
+        }
+        _stat_add(stats, passes, 1);
+        int fixed = G(hidden_singles)(c, q);
+        if (fixed <= 0)
+            return fixed == 0;
+    }
+}
+
+static void G(to_grid)(const FIELD *c, struct grid *g)
+{
+    g->box = BOX;
+    g->side = SIDE;
+    for (int p=0; p<CELLS; ++p)
+        g->cells[p] = c[p];
+}
+
+static void G(from_grid)(const struct grid *g, FIELD *c)
+{
+    for (int p=0; p<CELLS; ++p)
+        c[p] = g->cells[p] & ALL;
+}
+
+static void G(found_solution)(struct G(search) *srch, const FIELD *c)
+{
+    memcpy(srch->solution, c, sizeof(srch->solution));
+    srch->found++;
+    if (srch->collect != NULL) {
+        G(to_grid)(c, &srch->report);
+        if (!(*srch->collect)(srch->collect_arg, &srch->report))
+            srch->stop = true;
+    }
+    if (srch->max_solutions > 0 && srch->found >= srch->max_solutions)
+        srch->stop = true;
+}
+
+// The cells of unit u: the rows, then the columns, then the boxes
+static inline int G(unit_cell)(int u, int k)
+{
+    if (u < SIDE)
+        return u * SIDE + k;
+    if (u < 2 * SIDE)
+        return k * SIDE + u - SIDE;
+    u -= 2 * SIDE;
+    return (u / BOX * BOX + k / BOX) * SIDE + u % BOX * BOX + k % BOX;
+}
+
+// Look for a digit with fewer than limit places left in some unit (but
+// at least two). Branching on its places instead of a cell's candidates
+// pays off on large grids, where cells with two candidates are rare.
+// Returns the number of places, stored in where and bits, or 0.
+static int G(fewest_places)(const FIELD *c, int *where, FIELD *bits,
+                            int limit)
+{
+    int best_unit = -1, best_count = limit;
+    FIELD best_bit = 0;
+
+    for (int u=0; u<3*SIDE && best_count>2; ++u) {
+        FIELD cell[SIDE], open = 0;
+        for (int k=0; k<SIDE; ++k) {
+            cell[k] = c[G(unit_cell)(u, k)];
+            if (cell[k] & (cell[k] - 1))
+                open |= cell[k];
+        }
+        for (; open; open &= open - 1) {
+            FIELD bit = open & -open;
+            int count = 0;
+            for (int k=0; k<SIDE; ++k)
+                count += (cell[k] & bit) != 0;
+            if (count > 1 && count < best_count) {
+                best_unit = u;
+                best_count = count;
+                best_bit = bit;
+            }
+        }
+    }
+    if (best_unit < 0)
+        return 0;
+
+    int n = 0;
+    for (int k=0; k<SIDE; ++k) {
+        int p = G(unit_cell)(best_unit, k);
+        if (c[p] & best_bit) {
+            where[n] = p;
+            bits[n++] = best_bit;
+        }
+    }
+    return n;
+}
+
+// c has been set up and its changes queued
+static int G(search)(FIELD *c, struct G(search) *srch, int depth)
+{
+    FIELD child[CELLS];
+
+    if (!G(propagate)(c, &srch->queue, srch->stats)) {
+        srch->queue.n = 0;
+        return 0;
+    }
+
+    // The earliest cell with the fewest candidates
+    int best = -1, best_count = SIDE + 1;
+    for (int p=0; p<CELLS && best_count > 2; ++p) {
+        int count = grid_count_bits(c[p]);
+        if (count == 0)
+            return 0;
+        if (count > 1 && count < best_count) {
+            best = p;
+            best_count = count;
+        }
+    }
+    if (best < 0) {
+        G(found_solution)(srch, c);
+        return 1;
+    }
+
+    // Each branch fixes cell where[k] to the digit bits[k]: either the
+    // candidates of the chosen cell, or the places of a digit in a unit
+    int where[SIDE], n = 0;
+    FIELD bits[SIDE];
+    if (best_count == 2
+            || (n = G(fewest_places)(c, where, bits, best_count)) == 0) {
+        for (FIELD options = c[best]; options; options &= options - 1) {
+            where[n] = best;
+            bits[n++] = options & -options;
+        }
+    }
+    // Filling a grid tries them in random order
+    for (int k=n-1; srch->rng != NULL && k>0; --k) {
+        int m = sudoku_rng_below(srch->rng, k + 1);
+        int w = where[k];
+        FIELD b = bits[k];
+        where[k] = where[m];
+        bits[k] = bits[m];
+        where[m] = w;
+        bits[m] = b;
+    }
+
+    int solutions = 0;
+    _stat_max(srch->stats, max_depth, depth + 1);
+
+    for (int k=0; k<n; ++k) {
+        if (solver_budget_spent(srch->budget)
+                || ++srch->guesses == srch->max_guesses) {
+            srch->gave_up = srch->stop = true;
+            break;
+        }
+        _stat_add(srch->stats, guesses, 1);
+        memcpy(child, c, sizeof(child));
+        child[where[k]] = bits[k];
+        srch->queue.cells[srch->queue.n++] = where[k];
+
+        int solutions_here = G(search)(child, srch, depth + 1);
+        if (solutions_here > 0) {
+            if (!srch->check_unique)
+                return solutions_here;
+            solutions += solutions_here;
+        } else {
+            _stat_add(srch->stats, backtracks, 1);
+        }
+        if (srch->stop)
+            break;
+    }
+    return solutions;
+}
+
+static void G(search_init)(struct G(search) *srch, bool check_unique,
+                           struct solver_stats *stats)
+{
+    srch->stats = stats;
+    srch->check_unique = check_unique;
+    srch->collect = NULL;
+    srch->collect_arg = NULL;
+    srch->max_solutions = 0;
+    srch->found = 0;
+    srch->stop = false;
+    srch->guesses = 0;
+    srch->max_guesses = 0;
+    srch->gave_up = false;
+    srch->budget = NULL;
+    srch->rng = NULL;
+    srch->queue.n = 0;
+}
+
+// Queue the fixed cells of c and search
+static int G(run)(FIELD *c, struct G(search) *srch)
+{
+    srch->queue.n = 0;
+    for (int p=0; p<CELLS; ++p) {
+        if (grid_is_fixed(c[p]))
+            srch->queue.cells[srch->queue.n++] = p;
+    }
+    return G(search)(c, srch, 0);
+}
+
+static int G(solve)(struct grid *g, bool check_unique,
+                         grid_collector collect, void *collect_arg,
+                         const struct solver_options *opts)
+{
+    struct solver_stats scratch_stats = { 0 };
+    struct G(search) srch;
+    FIELD c[CELLS];
+
+    G(search_init)(&srch, check_unique,
+                   (opts && opts->stats) ? opts->stats : &scratch_stats);
+    srch.collect = collect;
+    srch.collect_arg = collect_arg;
+    srch.max_solutions = opts ? opts->max_solutions : 0;
+    srch.budget = opts ? opts->budget : NULL;
+
+    G(from_grid)(g, c);
+    int count = G(run)(c, &srch);
+    if (count > 0)
+        G(to_grid)(srch.solution, g);
+    return count;
+}
+
+static long G(rate)(const struct grid *g, struct solver_budget *budget)
+{
+    struct solver_stats stats;
+    struct G(search) srch;
+    FIELD c[CELLS];
+
+    G(search_init)(&srch, true, &stats);
+    srch.budget = budget;
+    G(from_grid)(g, c);
+    G(run)(c, &srch);
+    return srch.guesses;
+}
+
+/*
+ * Generation, as in generator.c: a random completed grid, then clues
+ * are taken away for as long as the solution stays unique.
+ */
+
+// A grid by randomized search, or FILL_SHUFFLE's relabelled and permuted
+// pattern grid. FILL_SOLVER is the search here.
+static void G(fill)(FIELD *c, struct sudoku_rng *rng)
+{
+    if (grid_fill == FILL_SHUFFLE) {
+        int digits[SIDE], rows[SIDE], cols[SIDE], bands[BOX], stacks[BOX];
+
+        for (int k=0; k<SIDE; ++k)
+            digits[k] = k;
+        grid_shuffle(digits, SIDE, rng);
+        for (int k=0; k<BOX; ++k)
+            bands[k] = stacks[k] = k;
+        grid_shuffle(bands, BOX, rng);
+        grid_shuffle(stacks, BOX, rng);
+        for (int b=0; b<BOX; ++b) {
+            for (int k=0; k<BOX; ++k) {
+                rows[b * BOX + k] = bands[b] * BOX + k;
+                cols[b * BOX + k] = stacks[b] * BOX + k;
+            }
+            grid_shuffle(rows + b * BOX, BOX, rng);
+            grid_shuffle(cols + b * BOX, BOX, rng);
+        }
+        bool transpose = sudoku_rng_below(rng, 2);
+
+        for (int i=0; i<SIDE; ++i) {
+            for (int j=0; j<SIDE; ++j) {
+                int r = rows[i], k = cols[j];
+                int d = (BOX * (r % BOX) + r / BOX + k) % SIDE;
+                c[transpose ? j * SIDE + i : i * SIDE + j] =
+                    (FIELD) 1 << digits[d];
+            }
+        }
+        return;
+    }
+
+    struct solver_stats stats;
+    struct G(search) srch;
+
+    G(search_init)(&srch, false, &stats);
+    srch.rng = rng;
+    for (int p=0; p<CELLS; ++p)
+        c[p] = ALL;
+    G(run)(c, &srch);
+    memcpy(c, srch.solution, sizeof(srch.solution));
+}
+
+// Is the known solution still the only one once the cells of the orbit
+// have been cleared in s?
+static bool G(still_unique)(const FIELD *s, const FIELD *solution,
+                            const int *orbit, int n)
+{
+    FIELD buffer[CELLS];
+    bool pinned = true;
+
+    // The clues in the row, column and box may pin every cell down
+    for (int k=0; k<n && pinned; ++k) {
+        int i = orbit[k] / SIDE, j = orbit[k] % SIDE;
+        int bi = i - i % BOX, bj = j - j % BOX;
+        FIELD others = 0;
+        for (int m=0; m<SIDE; ++m) {
+            FIELD row = s[i * SIDE + m], col = s[m * SIDE + j];
+            FIELD box = s[(bi + m / BOX) * SIDE + bj + m % BOX];
+            if (grid_is_fixed(row)) others |= row;
+            if (grid_is_fixed(col)) others |= col;
+            if (grid_is_fixed(box)) others |= box;
+        }
+        pinned = (others | solution[orbit[k]]) == ALL
+                 && !(others & solution[orbit[k]]);
+    }
+    if (pinned)
+        return true;
+
+    // Any second solution differs from the known one in a cleared cell
+    for (int k=0; k<n; ++k) {
+        struct solver_stats stats;
+        struct G(search) srch;
+
+        memcpy(buffer, s, sizeof(buffer));
+        buffer[orbit[k]] = ALL & ~solution[orbit[k]];
+        G(search_init)(&srch, false, &stats);
+        srch.max_guesses = GRID_UNIQUE_GUESSES;
+        if (G(run)(buffer, &srch) > 0 || srch.gave_up)
+            return false;
+    }
+    return true;
+}
+
+static int G(minimize)(FIELD *s, const FIELD *solution,
+                       struct sudoku_rng *rng,
+                       const struct generator_options *opts)
+{
+    int cells[CELLS], orbit[4];
+    int clues = 0;
+
+    for (int p=0; p<CELLS; ++p) {
+        cells[p] = p;
+        clues += grid_is_fixed(s[p]);
+    }
+    grid_shuffle(cells, CELLS, rng);
+
+    for (int k=0; k<CELLS && clues > opts->max_clues; ++k) {
+        int p = cells[k];
+        if (!grid_is_fixed(s[p]))
+            continue;
+
+        int n = grid_symmetric_cells(p, SIDE, opts->symmetry, orbit);
+        if (clues - n < opts->min_clues)
+            continue;
+
+        for (int m=0; m<n; ++m)
+            s[orbit[m]] = ALL;
+
+        if (G(still_unique)(s, solution, orbit, n)) {
+            clues -= n;
+        } else {
+            for (int m=0; m<n; ++m)
+                s[orbit[m]] = solution[orbit[m]];
+        }
+    }
+    return clues;
+}
+
+static int G(generate)(struct grid *g, struct sudoku_rng *rng,
+                       const struct generator_options *opts)
+{
+    FIELD solution[CELLS], puzzle[CELLS];
+    int max_attempts = opts->max_attempts > 0 ? opts->max_attempts
+                                              : GENERATOR_MAX_ATTEMPTS;
+
+    for (int attempts=1; attempts<=max_attempts; ++attempts) {
+        G(fill)(solution, rng);
+        memcpy(puzzle, solution, sizeof(puzzle));
+        int clues = G(minimize)(puzzle, solution, rng, opts);
+        G(to_grid)(puzzle, g);
+
+        if (opts->max_clues > 0 && clues > opts->max_clues)
+            continue;
+        if (opts->min_guesses > 0 || opts->max_guesses >= 0) {
+            struct solver_budget budget;
+            rating_budget(&budget, opts);
+            long guesses = G(rate)(g, &budget);
+            if (guesses < opts->min_guesses)
+                continue;
+            if (opts->max_guesses >= 0 && guesses > opts->max_guesses)
+                continue;
+        }
+        return attempts;
+    }
+    return 0;
+}
+
+#undef SIDE
+#undef CELLS
+#undef ALL
+#undef G
+#undef G_
+#undef G__
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include "libsudoku.h"
+
+struct sudoku_solver {
+    enum solver_engine engine;
+    struct solver_options opts;
+    struct solver_stats stats;
+    struct solver_budget budget;    // limits of each solve
+    struct trail *trail;        // only for ENGINE_TRAIL
+};
+
+struct sudoku_solver *sudoku_solver_new(enum solver_engine engine)
+{
+    struct sudoku_solver *ctx = malloc(sizeof(struct sudoku_solver));
+
+    if (ctx == NULL)
+        return NULL;
+    ctx->engine = engine;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    memset(&ctx->budget, 0, sizeof(ctx->budget));
+    memset(&ctx->opts, 0, sizeof(ctx->opts));
+    ctx->opts.stats = &ctx->stats;
+    ctx->opts.max_solutions = 0;
+    ctx->opts.propagation = PROPAGATE_SINGLES;
+    ctx->opts.branching = BRANCH_FIRST;
+    ctx->opts.budget = NULL;
+    ctx->trail = NULL;
+    if (engine == ENGINE_TRAIL && (ctx->trail = solver_trail_new()) == NULL) {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void sudoku_solver_free(struct sudoku_solver *ctx)
+{
+    if (ctx == NULL)
+        return;
+    solver_trail_free(ctx->trail);
+    free(ctx);
+}
+
+void sudoku_solver_set_max_solutions(struct sudoku_solver *ctx, int n)
+{
+    ctx->opts.max_solutions = n;
+}
+
+void sudoku_solver_set_propagation(struct sudoku_solver *ctx,
+                                   enum solver_propagation level)
+{
+    ctx->opts.propagation = level;
+}
+
+void sudoku_solver_set_branching(struct sudoku_solver *ctx,
+                                 enum solver_branching branching)
+{
+    ctx->opts.branching = branching;
+}
+
+void sudoku_solver_set_budget(struct sudoku_solver *ctx,
+                              unsigned long max_guesses, double max_seconds)
+{
+    ctx->budget.max_nodes = max_guesses;
+    ctx->budget.max_seconds = max_seconds > 0 ? max_seconds : 0;
+    ctx->budget.exceeded = false;
+    if (max_guesses == 0 && max_seconds <= 0)
+        ctx->opts.budget = NULL;
+    else
+        ctx->opts.budget = &ctx->budget;
+}
+
+bool sudoku_solver_gave_up(const struct sudoku_solver *ctx)
+{
+    return ctx->opts.budget != NULL && ctx->budget.exceeded;
+}
+
+int sudoku_solver_solve(struct sudoku_solver *ctx, sudoku_t s,
+                        bool check_unique)
+{
+    if (ctx->opts.budget)
+        solver_budget_start(ctx->opts.budget);
+    return _solve_engine(ctx->engine, ctx->trail, s, check_unique,
+                         NULL, NULL, &ctx->opts);
+}
+
+size_t sudoku_solver_solve_batch(struct sudoku_solver *ctx,
+                                 const sudoku_t *puzzles, sudoku_t *solutions,
+                                 int *counts, size_t n, bool check_unique)
+{
+    size_t solved = 0;
+    bool in_place = (const void *) solutions == (const void *) puzzles;
+
+    for (size_t k=0; k<n; ++k) {
+        if (!in_place)
+            memcpy(solutions[k], puzzles[k], sizeof(sudoku_t));
+        if (ctx->opts.budget)
+            solver_budget_start(ctx->opts.budget);
+        int count = _solve_engine(ctx->engine, ctx->trail, solutions[k],
+                                  check_unique, NULL, NULL, &ctx->opts);
+        if (sudoku_solver_gave_up(ctx))
+            count = -1;
+        if (counts)
+            counts[k] = count;
+        solved += count > 0;
+    }
+    return solved;
+}
+
+const struct solver_stats *sudoku_solver_stats(const struct sudoku_solver *ctx)
+{
+    return &ctx->stats;
+}
@@ -0,0 +1,53 @@
+#ifndef _SUDOKU_LIBSUDOKU_H
+#define _SUDOKU_LIBSUDOKU_H
+
+#include "solver.h"
+
+// A reusable solver for embedding: everything a solve needs is allocated
+// when the context is created, and nothing is shared between contexts or
+// read from globals such as solver_engine. Use one context per thread.
+struct sudoku_solver;
+
+struct sudoku_solver *sudoku_solver_new(enum solver_engine engine);
+void sudoku_solver_free(struct sudoku_solver *ctx);
+
+// Stop counting after n solutions (0: no limit, the default)
+void sudoku_solver_set_max_solutions(struct sudoku_solver *ctx, int n);
+
+// Propagation level of the classic and trail engines (default
+// PROPAGATE_SINGLES)
+void sudoku_solver_set_propagation(struct sudoku_solver *ctx,
+                                   enum solver_propagation level);
+
+// What the classic and trail engines branch on (default BRANCH_FIRST)
+void sudoku_solver_set_branching(struct sudoku_solver *ctx,
+                                 enum solver_branching branching);
+
+// Give up on a puzzle after max_guesses guesses or max_seconds of wall-clock
+// time, each 0 for no limit (the default). The limits apply to every solve
+// on their own.
+void sudoku_solver_set_budget(struct sudoku_solver *ctx,
+                              unsigned long max_guesses, double max_seconds);
+
+// Whether the last sudoku_solver_solve gave up on the budget; its count is
+// then only the solutions found so far.
+bool sudoku_solver_gave_up(const struct sudoku_solver *ctx);
+
+// Solve s in place. With check_unique, returns the number of solutions
+// (up to the limit), otherwise 1 if s was solved and 0 if it has no
+// solution.
+int sudoku_solver_solve(struct sudoku_solver *ctx, sudoku_t s,
+                        bool check_unique);
+
+// Solve puzzles[0..n-1] into solutions[0..n-1], which may be the same
+// array. counts (may be NULL) gets what sudoku_solver_solve returns for
+// each puzzle, or -1 for one it gave up on. Returns the number of puzzles that have a solution.
+size_t sudoku_solver_solve_batch(struct sudoku_solver *ctx,
+                                 const sudoku_t *puzzles, sudoku_t *solutions,
+                                 int *counts, size_t n, bool check_unique);
+
+// Search statistics of all solves so far (zero unless built with
+// SOLVER_STATS=1)
+const struct solver_stats *sudoku_solver_stats(const struct sudoku_solver *ctx);
+
+#endif /* _SUDOKU_LIBSUDOKU_H */
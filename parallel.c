@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "solver.h"
+
+/*
+ * Parallel counting and enumeration of the solutions of one puzzle.
+ *
+ * The search tree is split at the guess points of the classic engine down
+ * to SPLIT_DEPTH; every subtree below that is handed to _solve as a whole.
+ * Each worker keeps the open subtrees in its own deque: it works on the
+ * newest one (depth first), while idle workers steal the oldest, i.e.
+ * largest, subtrees from the other end.
+ *
+ * The pool's counters are atomic, so pushing, popping and stealing only
+ * take the lock of the deque concerned. The pool lock is there for the
+ * condition variable alone: it is taken by workers about to sleep, and
+ * by the others only to wake them.
+ */
+
+#define SPLIT_DEPTH 12
+// One task in progress plus at most eight siblings pushed per level
+#define DEQUE_SIZE (9 * (SPLIT_DEPTH + 1))
+// Solutions a worker collects before it hands them on
+#define SOLUTION_BATCH 256
+
+struct task {
+    sudoku_t field;
+    int depth;
+};
+
+struct deque {
+    pthread_mutex_t lock;
+    struct task tasks[DEQUE_SIZE];
+    unsigned top;       // thieves take from here
+    unsigned bottom;    // the owner pushes and pops here
+};
+
+struct pool;
+
+struct worker {
+    struct pool *pool;
+    pthread_t thread;
+    bool started;       // thread is running (or has been)
+    int index;
+    struct deque deque;
+
+    int count;
+    struct solver_stats stats;
+    struct solver_options opts;
+    bool have_solution;
+    sudoku_t a_solution;
+    int n_solutions;
+    sudoku_t solutions[SOLUTION_BATCH];
+};
+
+// The atomics of the pool; sequentially consistent, which the handshake
+// between push_task and take_task relies on
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+#define ADD(x, n) __atomic_add_fetch(&(x), (n), __ATOMIC_SEQ_CST)
+
+struct pool {
+    pthread_mutex_t lock;           // guards work_available only
+    pthread_cond_t work_available;
+    int sleepers;       // workers waiting on work_available
+    int pending;        // tasks created but not finished (atomic)
+    int queued;         // tasks sitting in some deque (atomic)
+    int found;          // solutions counted against max_solutions (atomic)
+    bool stop;          // skip the remaining tasks (atomic)
+
+    struct worker *workers;
+    int n_workers;
+
+    int max_solutions;
+
+    solution_collector collect;
+    void *collect_arg;
+    pthread_mutex_t collect_lock;
+    int delivered;      // solutions passed to collect
+    bool collect_done;  // the collector wants no more
+};
+
+static void push_task(struct worker *w, sudoku_t field, int depth)
+{
+    struct deque *dq = &w->deque;
+    struct pool *p = w->pool;
+
+    // Counted before anyone can take it, so that neither count dips
+    ADD(p->pending, 1);
+    ADD(p->queued, 1);
+
+    pthread_mutex_lock(&dq->lock);
+    struct task *t = &dq->tasks[dq->bottom++ % DEQUE_SIZE];
+    memcpy(t->field, field, sizeof(sudoku_t));
+    t->depth = depth;
+    pthread_mutex_unlock(&dq->lock);
+
+    // A worker counts itself a sleeper before it last looks at queued,
+    // so either it sees the task or we see it
+    if (LOAD(p->sleepers) > 0) {
+        pthread_mutex_lock(&p->lock);
+        pthread_cond_signal(&p->work_available);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+static bool pop_task(struct deque *dq, struct task *t, bool steal)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->top != dq->bottom) {
+        if (steal)
+            *t = dq->tasks[dq->top++ % DEQUE_SIZE];
+        else
+            *t = dq->tasks[--dq->bottom % DEQUE_SIZE];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+
+    return found;
+}
+
+// Get the next task, from our own deque or someone else's. Returns false
+// once the whole tree has been searched.
+static bool take_task(struct worker *w, struct task *t)
+{
+    struct pool *p = w->pool;
+
+    for (;;) {
+        bool found = pop_task(&w->deque, t, false);
+        for (int k=1; !found && k<p->n_workers; ++k) {
+            struct worker *victim = &p->workers[(w->index + k) % p->n_workers];
+            found = pop_task(&victim->deque, t, true);
+        }
+
+        if (found) {
+            ADD(p->queued, -1);
+            return true;
+        }
+
+        pthread_mutex_lock(&p->lock);
+        ADD(p->sleepers, 1);
+        while (LOAD(p->queued) == 0 && LOAD(p->pending) > 0)
+            pthread_cond_wait(&p->work_available, &p->lock);
+        ADD(p->sleepers, -1);
+        pthread_mutex_unlock(&p->lock);
+        if (LOAD(p->pending) == 0)
+            return false;
+    }
+}
+
+static void finish_task(struct pool *p)
+{
+    // The last task wakes everyone up to leave
+    if (ADD(p->pending, -1) == 0) {
+        pthread_mutex_lock(&p->lock);
+        pthread_cond_broadcast(&p->work_available);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+static void stop_search(struct pool *p)
+{
+    STORE(p->stop, true);
+}
+
+static bool search_stopped(struct pool *p)
+{
+    return LOAD(p->stop);
+}
+
+// Hand the buffered solutions to the collector. Returns false once no
+// more solutions are wanted. Collectors need not be thread safe: they are
+// called under collect_lock, which the batching keeps uncontended.
+static bool flush_solutions(struct worker *w)
+{
+    struct pool *p = w->pool;
+    bool more;
+
+    pthread_mutex_lock(&p->collect_lock);
+    for (int k=0; k<w->n_solutions && !p->collect_done; ++k) {
+        p->delivered++;
+        if (!(*p->collect)(p->collect_arg, w->solutions[k]))
+            p->collect_done = true;
+        if (p->max_solutions > 0 && p->delivered >= p->max_solutions)
+            p->collect_done = true;
+    }
+    more = !p->collect_done;
+    pthread_mutex_unlock(&p->collect_lock);
+
+    w->n_solutions = 0;
+    if (!more)
+        stop_search(p);
+    return more;
+}
+
+static bool worker_collect(void *arg, sudoku_t s)
+{
+    struct worker *w = arg;
+
+    memcpy(w->solutions[w->n_solutions++], s, sizeof(sudoku_t));
+    if (w->n_solutions == SOLUTION_BATCH)
+        return flush_solutions(w);
+    return true;
+}
+
+static void run_task(struct worker *w, struct task *t)
+{
+    int status;
+    int gi, gj;
+
+    // The guess that made this task is charged as the engines would
+    if (t->depth > 0 && solver_budget_spent(w->opts.budget)) {
+        stop_search(w->pool);
+        return;
+    }
+
+    status = propagate_sudoku(t->field);
+
+    if (status == SUDOKU_ERROR) {
+        _stat_add(&w->stats, backtracks, t->depth > 0);
+        return;
+    }
+
+    if (status == SUDOKU_DONE || t->depth >= SPLIT_DEPTH
+            || !choose_guess(t->field, &gi, &gj)) {
+        // Search this subtree here and now
+        solution_collector collect = w->pool->collect ? worker_collect : NULL;
+        int n = _solve_with(t->field, true, collect, w, &w->opts);
+        if (w->opts.budget != NULL && LOAD(w->opts.budget->exceeded))
+            stop_search(w->pool);
+        if (n > 0) {
+            w->count += n;
+            w->have_solution = true;
+            memcpy(w->a_solution, t->field, sizeof(sudoku_t));
+
+            struct pool *p = w->pool;
+            if (p->max_solutions > 0 && ADD(p->found, n) >= p->max_solutions)
+                stop_search(p);
+        } else {
+            _stat_add(&w->stats, backtracks, t->depth > 0);
+        }
+        return;
+    }
+
+    // Push the guesses so that the lowest digit is popped first
+    field_t options = t->field[gi][gj];
+    _stat_add(&w->stats, guesses, count_bits(options));
+    _stat_max(&w->stats, max_depth, t->depth + 1);
+    for (int d=8; d>=0; --d) {
+        if ((options >> d) & 1) {
+            t->field[gi][gj] = 1 << d;
+            push_task(w, t->field, t->depth + 1);
+        }
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct task t;
+
+    while (take_task(w, &t)) {
+        if (!search_stopped(w->pool))
+            run_task(w, &t);
+        finish_task(w->pool);
+    }
+
+    if (w->pool->collect)
+        flush_solutions(w);
+    return NULL;
+}
+
+int _solve_parallel(sudoku_t s, bool check_unique,
+                    solution_collector collect, void *collect_arg,
+                    const struct solver_options *opts, int n_threads)
+{
+    struct pool p;
+    int count = 0;
+    int n_started = 0;
+
+    // Looking for a single solution is a job for the sequential search
+    if (!check_unique || n_threads <= 1)
+        return _solve_with(s, check_unique, collect, collect_arg, opts);
+
+    p.workers = malloc(n_threads * sizeof(struct worker));
+    if (p.workers == NULL)
+        return _solve_with(s, check_unique, collect, collect_arg, opts);
+
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.work_available, NULL);
+    pthread_mutex_init(&p.collect_lock, NULL);
+    p.sleepers = p.pending = p.queued = 0;
+    p.found = 0;
+    p.stop = false;
+    p.n_workers = n_threads;
+    p.max_solutions = opts ? opts->max_solutions : 0;
+    p.collect = collect;
+    p.collect_arg = collect_arg;
+    p.delivered = 0;
+    p.collect_done = false;
+
+    for (int i=0; i<n_threads; ++i) {
+        struct worker *w = &p.workers[i];
+        w->pool = &p;
+        w->started = false;
+        w->index = i;
+        w->count = 0;
+        memset(&w->stats, 0, sizeof(w->stats));
+        if (opts)
+            w->opts = *opts;
+        else
+            memset(&w->opts, 0, sizeof(w->opts));
+        w->opts.stats = &w->stats;
+        w->have_solution = false;
+        w->n_solutions = 0;
+        w->deque.top = w->deque.bottom = 0;
+        pthread_mutex_init(&w->deque.lock, NULL);
+    }
+
+    // One budget for all: the workers charge it together, so that the
+    // limit holds for the whole search as it does for a sequential one
+    if (opts && opts->budget)
+        opts->budget->shared = true;
+
+    push_task(&p.workers[0], s, 0);
+
+    // Those that started steal the work of any that did not
+    for (int i=0; i<n_threads; ++i) {
+        struct worker *w = &p.workers[i];
+        w->started = pthread_create(&w->thread, NULL, worker_main, w) == 0;
+        n_started += w->started;
+    }
+
+    bool have_solution = false;
+    for (int i=0; i<n_threads; ++i) {
+        struct worker *w = &p.workers[i];
+        if (!w->started)
+            continue;
+        pthread_join(w->thread, NULL);
+        count += w->count;
+        if (opts && opts->stats)
+            solver_stats_add(opts->stats, &w->stats);
+        if (w->have_solution && !have_solution) {
+            memcpy(s, w->a_solution, sizeof(sudoku_t));
+            have_solution = true;
+        }
+    }
+    if (opts && opts->budget)
+        opts->budget->shared = false;
+
+    // Only now: the workers still running may have been about to steal
+    // from those that already left
+    for (int i=0; i<n_threads; ++i)
+        pthread_mutex_destroy(&p.workers[i].deque.lock);
+
+    // Workers may have overshot the limit before they saw the stop
+    if (collect)
+        count = p.delivered;
+    else if (p.max_solutions > 0 && count > p.max_solutions)
+        count = p.max_solutions;
+
+    free(p.workers);
+    pthread_mutex_destroy(&p.collect_lock);
+    pthread_cond_destroy(&p.work_available);
+    pthread_mutex_destroy(&p.lock);
+
+    // Not a single thread: nothing has been searched yet
+    if (n_started == 0)
+        return _solve_with(s, check_unique, collect, collect_arg, opts);
+    return count;
+}
@@ -0,0 +1,326 @@
+#include "simd.h"
+
+#if SOLVER_SIMD
+
+/*
+ * Vectorized constraint propagation.
+ *
+ * Each row of the grid lives in one vector of 16 uint16 lanes: lanes 0-8
+ * hold the cells and lanes 9-15 stay zero. For every unit we track which
+ * digits occur in at least one cell ("once") and in at least two cells
+ * ("twice"); combining two such pairs is associative, so rows reduce with
+ * a butterfly of shuffles, columns with plain vertical operations over
+ * the nine rows, and boxes with both.
+ *
+ * From these, one round applies both singles rules to every cell at
+ * once: a digit fixed in a peer is removed (naked singles, what _impose
+ * does), and a digit that has no other place in the row, column or box
+ * (tried in that order) fixes the cell (hidden singles). Rounds repeat
+ * until nothing changes or a cell runs out of digits. Both rules only
+ * remove digits that no solution can use, so the result is the same
+ * fixed point the classic engine's queues reach, whenever the grid has
+ * a solution at all.
+ */
+
+// Everything down to the pop is only called once the CPU checked out
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+typedef uint16_t v16u __attribute__((vector_size(32)));
+
+#define KERNEL static inline __attribute__((always_inline))
+
+static const v16u cell_lanes = {
+    0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff,
+    0, 0, 0, 0, 0, 0, 0
+};
+
+// (o, t) += (o2, t2)
+KERNEL void add(v16u *o, v16u *t, v16u o2, v16u t2)
+{
+    *t |= t2 | (*o & o2);
+    *o |= o2;
+}
+
+KERNEL void add_shuffled(v16u *o, v16u *t, v16u mask)
+{
+    add(o, t, __builtin_shuffle(*o, mask), __builtin_shuffle(*t, mask));
+}
+
+// Give every lane the total over the whole vector
+KERNEL void reduce_row(v16u *o, v16u *t)
+{
+    const v16u xor1 = { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 };
+    const v16u xor2 = { 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13 };
+    const v16u xor4 = { 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11 };
+    const v16u xor8 = { 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+    add_shuffled(o, t, xor1);
+    add_shuffled(o, t, xor2);
+    add_shuffled(o, t, xor4);
+    add_shuffled(o, t, xor8);
+}
+
+// Give every lane the total over its group of three (lanes 0-2, 3-5, 6-8)
+KERNEL void reduce_stacks(v16u *o, v16u *t)
+{
+    const v16u next = { 1, 2, 0, 4, 5, 3, 7, 8, 6, 9, 10, 11, 12, 13, 14, 15 };
+    const v16u prev = { 2, 0, 1, 5, 3, 4, 8, 6, 7, 9, 10, 11, 12, 13, 14, 15 };
+    v16u o1 = __builtin_shuffle(*o, next), t1 = __builtin_shuffle(*t, next);
+    v16u o2 = __builtin_shuffle(*o, prev), t2 = __builtin_shuffle(*t, prev);
+
+    add(o, t, o1, t1);
+    add(o, t, o2, t2);
+}
+
+// Lanes holding exactly one digit
+KERNEL v16u single_lanes(v16u x)
+{
+    return (v16u) ((x & (x - 1)) == 0) & (v16u) (x != 0);
+}
+
+KERNEL bool any_lane(v16u x)
+{
+    uint64_t w[4];
+    memcpy(w, &x, sizeof(w));
+    return (w[0] | w[1] | w[2] | w[3]) != 0;
+}
+
+KERNEL void propagate_rows(v16u x[9], struct solver_stats *stats)
+{
+    v16u zero = { 0 };
+
+    for (;;) {
+        v16u fixed[9];
+        v16u row_o[9], row_t[9], fix_o[9], fix_t[9];
+        v16u col_o = zero, col_t = zero, colfix_o = zero, colfix_t = zero;
+        v16u box_o[3], box_t[3], boxfix_o[3], boxfix_t[3];
+        v16u changed = zero, empty = zero;
+
+        _stat_add(stats, passes, 1);
+
+        for (int r=0; r<9; ++r) {
+            fixed[r] = x[r] & single_lanes(x[r]);
+
+            row_o[r] = x[r];
+            row_t[r] = zero;
+            reduce_row(&row_o[r], &row_t[r]);
+            fix_o[r] = fixed[r];
+            fix_t[r] = zero;
+            reduce_row(&fix_o[r], &fix_t[r]);
+
+            add(&col_o, &col_t, x[r], zero);
+            add(&colfix_o, &colfix_t, fixed[r], zero);
+        }
+
+        for (int b=0; b<3; ++b) {
+            box_o[b] = box_t[b] = boxfix_o[b] = boxfix_t[b] = zero;
+            for (int r=3*b; r<3*b+3; ++r) {
+                add(&box_o[b], &box_t[b], x[r], zero);
+                add(&boxfix_o[b], &boxfix_t[b], fixed[r], zero);
+            }
+            reduce_stacks(&box_o[b], &box_t[b]);
+            reduce_stacks(&boxfix_o[b], &boxfix_t[b]);
+        }
+
+        for (int r=0; r<9; ++r) {
+            v16u f = fixed[r];
+            v16u y = x[r];
+
+            // Hidden singles; the row wins over the column over the box
+            v16u h = x[r] & ~box_t[r / 3];
+            v16u m = single_lanes(h);
+            y = (h & m) | (y & ~m);
+            h = x[r] & ~col_t;
+            m = single_lanes(h);
+            y = (h & m) | (y & ~m);
+            h = x[r] & ~row_t[r];
+            m = single_lanes(h);
+            y = (h & m) | (y & ~m);
+
+            // Naked singles: digits fixed in some other cell of a unit
+            v16u fixed_o = fix_o[r] | colfix_o | boxfix_o[r / 3];
+            v16u fixed_t = fix_t[r] | colfix_t | boxfix_t[r / 3];
+            y &= ~((fixed_o & ~f) | (fixed_t & f));
+
+            changed |= y ^ x[r];
+            empty |= (v16u) (y == 0) & cell_lanes;
+            x[r] = y;
+        }
+
+        if (any_lane(empty) || !any_lane(changed))
+            return;
+    }
+}
+
+static void propagate_avx2(sudoku_t s, struct solver_stats *stats)
+{
+    v16u x[9];
+
+    for (int r=0; r<9; ++r) {
+        x[r] = (v16u) { 0 };
+        memcpy(&x[r], s[r], sizeof(s[r]));
+    }
+    propagate_rows(x, stats);
+    for (int r=0; r<9; ++r)
+        memcpy(s[r], &x[r], sizeof(s[r]));
+}
+
+/*
+ * Lane mode: the same rules for SIMD_LANES puzzles at once. Cell c of
+ * puzzle k is lane k of x[c], so every unit reduces with vertical
+ * operations alone, and one round costs little more than the scalar
+ * pass over a single puzzle.
+ */
+
+static const uint8_t unit_cells[27][9] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8 },
+    {  9, 10, 11, 12, 13, 14, 15, 16, 17 },
+    { 18, 19, 20, 21, 22, 23, 24, 25, 26 },
+    { 27, 28, 29, 30, 31, 32, 33, 34, 35 },
+    { 36, 37, 38, 39, 40, 41, 42, 43, 44 },
+    { 45, 46, 47, 48, 49, 50, 51, 52, 53 },
+    { 54, 55, 56, 57, 58, 59, 60, 61, 62 },
+    { 63, 64, 65, 66, 67, 68, 69, 70, 71 },
+    { 72, 73, 74, 75, 76, 77, 78, 79, 80 },
+    {  0,  9, 18, 27, 36, 45, 54, 63, 72 },
+    {  1, 10, 19, 28, 37, 46, 55, 64, 73 },
+    {  2, 11, 20, 29, 38, 47, 56, 65, 74 },
+    {  3, 12, 21, 30, 39, 48, 57, 66, 75 },
+    {  4, 13, 22, 31, 40, 49, 58, 67, 76 },
+    {  5, 14, 23, 32, 41, 50, 59, 68, 77 },
+    {  6, 15, 24, 33, 42, 51, 60, 69, 78 },
+    {  7, 16, 25, 34, 43, 52, 61, 70, 79 },
+    {  8, 17, 26, 35, 44, 53, 62, 71, 80 },
+    {  0,  1,  2,  9, 10, 11, 18, 19, 20 },
+    {  3,  4,  5, 12, 13, 14, 21, 22, 23 },
+    {  6,  7,  8, 15, 16, 17, 24, 25, 26 },
+    { 27, 28, 29, 36, 37, 38, 45, 46, 47 },
+    { 30, 31, 32, 39, 40, 41, 48, 49, 50 },
+    { 33, 34, 35, 42, 43, 44, 51, 52, 53 },
+    { 54, 55, 56, 63, 64, 65, 72, 73, 74 },
+    { 57, 58, 59, 66, 67, 68, 75, 76, 77 },
+    { 60, 61, 62, 69, 70, 71, 78, 79, 80 },
+};
+
+KERNEL void propagate_cells(v16u x[81])
+{
+    v16u zero = { 0 };
+
+    for (;;) {
+        v16u fixed[81];
+        v16u unit_t[27], fix_o[27], fix_t[27];
+        v16u changed = zero;
+
+        for (int c=0; c<81; ++c)
+            fixed[c] = x[c] & single_lanes(x[c]);
+
+        for (int u=0; u<27; ++u) {
+            v16u o = zero, t = zero, fo = zero, ft = zero;
+            for (int k=0; k<9; ++k) {
+                int c = unit_cells[u][k];
+                add(&o, &t, x[c], zero);
+                add(&fo, &ft, fixed[c], zero);
+            }
+            unit_t[u] = t;
+            fix_o[u] = fo;
+            fix_t[u] = ft;
+        }
+
+        for (int c=0; c<81; ++c) {
+            int row = c / 9, col = 9 + c % 9;
+            int box = 18 + (c / 27) * 3 + c % 9 / 3;
+            v16u f = fixed[c];
+            v16u y = x[c];
+
+            v16u h = x[c] & ~unit_t[box];
+            v16u m = single_lanes(h);
+            y = (h & m) | (y & ~m);
+            h = x[c] & ~unit_t[col];
+            m = single_lanes(h);
+            y = (h & m) | (y & ~m);
+            h = x[c] & ~unit_t[row];
+            m = single_lanes(h);
+            y = (h & m) | (y & ~m);
+
+            v16u fixed_o = fix_o[row] | fix_o[col] | fix_o[box];
+            v16u fixed_t = fix_t[row] | fix_t[col] | fix_t[box];
+            y &= ~((fixed_o & ~f) | (fixed_t & f));
+
+            changed |= y ^ x[c];
+            x[c] = y;
+        }
+
+        if (!any_lane(changed))
+            return;
+    }
+}
+
+static void propagate_lanes_avx2(sudoku_t *s, int n)
+{
+    v16u x[81];
+
+    for (int c=0; c<81; ++c) {
+        x[c] = (v16u) { 0 };
+        for (int k=0; k<n; ++k)
+            x[c][k] = s[k][c / 9][c % 9];
+    }
+    propagate_cells(x);
+    for (int c=0; c<81; ++c) {
+        for (int k=0; k<n; ++k)
+            s[k][c / 9][c % 9] = x[c][k];
+    }
+}
+
+#pragma GCC pop_options
+
+#endif /* SOLVER_SIMD */
+
+#if SOLVER_STATS
+static void count_cells(sudoku_t s, unsigned long *digits,
+                        unsigned long *fixed)
+{
+    *digits = *fixed = 0;
+    for (int i=0; i<9; ++i) {
+        for (int j=0; j<9; ++j) {
+            *digits += count_bits(s[i][j]);
+            *fixed += is_fixed(s[i][j]);
+        }
+    }
+}
+#endif
+
+bool simd_propagate_lanes(sudoku_t *s, int n)
+{
+#if SOLVER_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        propagate_lanes_avx2(s, n);
+        return true;
+    }
+#endif
+    (void) s;
+    (void) n;
+    return false;
+}
+
+bool simd_propagate(sudoku_t s, struct solver_stats *stats)
+{
+#if SOLVER_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+#if SOLVER_STATS
+        unsigned long digits0, fixed0, digits1, fixed1;
+        count_cells(s, &digits0, &fixed0);
+#endif
+        propagate_avx2(s, stats);
+#if SOLVER_STATS
+        count_cells(s, &digits1, &fixed1);
+        _stat_add(stats, eliminations, digits0 - digits1);
+        _stat_add(stats, imposes, fixed1 - fixed0);
+#endif
+        return true;
+    }
+#endif
+    (void) s;
+    (void) stats;
+    return false;
+}
@@ -0,0 +1,30 @@
+#ifndef _SUDOKU_SIMD_H
+#define _SUDOKU_SIMD_H
+
+#include "solver.h"
+
+// make SIMD=0 builds without the vector kernels
+#ifndef SOLVER_SIMD
+#   if defined(__GNUC__) && defined(__x86_64__)
+#       define SOLVER_SIMD 1
+#   else
+#       define SOLVER_SIMD 0
+#   endif
+#endif
+
+// Propagate naked and hidden singles in s until nothing changes, with
+// vector instructions, sweeping the whole grid each round. Returns false,
+// leaving s alone, when the CPU lacks them; the caller then works through
+// its queues in scalar code.
+bool simd_propagate(sudoku_t s, struct solver_stats *stats);
+
+// Puzzles per call of simd_propagate_lanes
+#define SIMD_LANES 16
+
+// The same for n <= SIMD_LANES puzzles at once, one per vector lane.
+// Afterwards check_solution tells for each grid whether it is solved
+// (the puzzle then has exactly this one solution), contradictory (no
+// solution) or still open.
+bool simd_propagate_lanes(sudoku_t *s, int n);
+
+#endif /* _SUDOKU_SIMD_H */
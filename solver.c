@@ -1,140 +1,690 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include "solver.h"
+#include "bitboard.h"
+#include "dlx.h"
+#include "simd.h"
+#include "generator.h"
+
+enum solver_engine solver_engine = ENGINE_BITBOARD;
 
-static inline void remove_option(field_t number, field_t *place)
+double solver_clock(void)
 {
-    *place &= ~number;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-inline void impose(sudoku_t field, int i, int j, bool recurse)
+void solver_budget_start(struct solver_budget *b)
 {
-    int k, l;
-    int ii_now_fixed[81];
-    int jj_now_fixed[81];
-    int newly_fixed_count = 0;
+    b->exceeded = false;
+    b->nodes = 0;
+    if (b->max_seconds > 0)
+        b->deadline = solver_clock() + b->max_seconds;
+}
 
-    // impose the constraint of location [i,j] on its peers
-    field_t f = field[i][j];
-    if (!is_fixed(f)) return;
+// A guess that finds the budget spent takes its charge back, so nodes
+// ends up at the number of guesses made, as with a private budget
+bool _solver_budget_spent_shared(struct solver_budget *b)
+{
+    if (__atomic_load_n(&b->exceeded, __ATOMIC_RELAXED))
+        return true;
 
-    for (k=0; k<9; ++k) {
-        // Check my row!
-        if (k != j){
-            bool was_fixed = is_fixed(field[i][k]);
-            remove_option(f, &field[i][k]);
+    unsigned long n = __atomic_fetch_add(&b->nodes, 1, __ATOMIC_RELAXED);
+    if ((b->max_nodes > 0 && n >= b->max_nodes)
+            || (b->max_seconds > 0 && n % SOLVER_BUDGET_CLOCK_EVERY == 0
+                && solver_clock() >= b->deadline)) {
+        __atomic_fetch_sub(&b->nodes, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&b->exceeded, true, __ATOMIC_RELAXED);
+        return true;
+    }
+    return false;
+}
 
-            if (recurse && !was_fixed && is_fixed(field[i][k])) {
-                ii_now_fixed[newly_fixed_count] = i;
-                jj_now_fixed[newly_fixed_count] = k;
-                newly_fixed_count++;
-            }
+bool solver_engine_from_name(const char *name, enum solver_engine *engine)
+{
+    if (strcmp(name, "classic") == 0) {
+        *engine = ENGINE_CLASSIC;
+    } else if (strcmp(name, "trail") == 0) {
+        *engine = ENGINE_TRAIL;
+    } else if (strcmp(name, "bitboard") == 0) {
+        *engine = ENGINE_BITBOARD;
+    } else if (strcmp(name, "dlx") == 0) {
+        *engine = ENGINE_DLX;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+enum solver_propagation solver_propagation = PROPAGATE_SINGLES;
+
+static const char *const propagation_names[] = {
+    "default", "singles", "locked", "subsets", "fish"
+};
+
+bool solver_propagation_from_name(const char *name,
+                                  enum solver_propagation *level)
+{
+    for (int k=PROPAGATE_SINGLES; k<=PROPAGATE_FISH; ++k) {
+        if (strcmp(name, propagation_names[k]) == 0) {
+            *level = k;
+            return true;
         }
-        // Check my column!
-        if (k != i){
-            bool was_fixed = is_fixed(field[k][j]);
-            remove_option(f, &field[k][j]);
-
-            if (recurse && !was_fixed && is_fixed(field[k][j])) {
-                ii_now_fixed[newly_fixed_count] = k;
-                jj_now_fixed[newly_fixed_count] = j;
-                newly_fixed_count++;
-            }
+    }
+    return false;
+}
+
+enum solver_branching solver_branching = BRANCH_FIRST;
+
+static const char *const branching_names[] = {
+    "default", "first", "degree", "places", "random"
+};
+
+bool solver_branching_from_name(const char *name,
+                                enum solver_branching *branching)
+{
+    for (int k=BRANCH_FIRST; k<=BRANCH_RANDOM; ++k) {
+        if (strcmp(name, branching_names[k]) == 0) {
+            *branching = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// First budget of guesses for BRANCH_RANDOM; it doubles with every
+// restart, so the search stays complete.
+#define RESTART_GUESSES 100
+
+// Every cell can be logged at most once per choice point, and there
+// can be no more choice points than cells.
+#define TRAIL_SIZE (81 * 82)
+
+// Undo log for the trail engine: the old values of the cells changed
+// since each choice point.
+struct trail {
+    struct {
+        uint8_t cell;
+        field_t old;
+    } entries[TRAIL_SIZE];
+    int n;
+    uint32_t generation;
+    uint32_t stamp[81];     // generation in which the cell was last logged
+};
+
+// Kept up to date with every candidate removed, and saved and restored
+// with the grid, so that neither propagation nor branching has to scan
+// the whole grid.
+struct tallies {
+    uint8_t counts[27][9];          // cells of each unit with each digit
+    uint8_t open[27];               // cells of each unit not fixed yet
+    uint8_t size[81];               // candidates of each cell
+    uint64_t by_size[10][2];        // the cells of each size, as bit sets
+};
+
+// State of one run of the classic or trail engine
+struct search {
+    struct trail *trail;            // NULL: no undo log
+    struct solver_stats *stats;
+    bool check_unique;
+    solution_collector collect;
+    void *collect_arg;
+    int max_solutions;              // 0: no limit
+    int found;                      // solutions found so far
+    bool stop;                      // limit reached or collector said so
+    enum solver_propagation level;  // PROPAGATE_SINGLES if not set
+    enum solver_branching branching;    // BRANCH_FIRST if not set
+    uint32_t dirty;                 // units changed since the last reduce
+    struct sudoku_rng rng;          // digit order of BRANCH_RANDOM
+    long restart_after;             // guesses before a restart (0: never)
+    long guesses;                   // guesses since the last restart
+    bool restart;                   // restart_after ran out
+    struct solver_budget *budget;   // per-puzzle limit (or NULL)
+
+    // Propagation state, see below
+    struct tallies tally;
+    uint8_t fixed[81];              // cells to impose on their peers
+    int n_fixed;
+    uint8_t hidden[27 * 9];         // unit*9+digit with one place left
+    int n_hidden;
+    bool contradiction;
+};
+
+static void init_search(struct search *srch, struct solver_stats *stats)
+{
+    srch->trail = NULL;
+    srch->stats = stats;
+    srch->check_unique = false;
+    srch->collect = NULL;
+    srch->collect_arg = NULL;
+    srch->max_solutions = 0;
+    srch->found = 0;
+    srch->stop = false;
+    srch->level = PROPAGATE_SINGLES;
+    srch->branching = BRANCH_FIRST;
+    srch->dirty = 0;
+    sudoku_rng_seed(&srch->rng, 0, 0);
+    srch->restart_after = 0;
+    srch->guesses = 0;
+    srch->restart = false;
+    srch->budget = NULL;
+    srch->n_fixed = 0;
+    srch->n_hidden = 0;
+    srch->contradiction = false;
+}
+
+static inline void set_field(sudoku_t field, int i, int j, field_t value,
+                             struct search *srch)
+{
+    struct trail *t = srch->trail;
+
+    if (t != NULL && t->stamp[i*9+j] != t->generation) {
+        t->stamp[i*9+j] = t->generation;
+        t->entries[t->n].cell = i*9+j;
+        t->entries[t->n].old = field[i][j];
+        t->n++;
+    }
+    field[i][j] = value;
+}
+
+/*
+ * Constraint propagation. Units are numbered rows 0-8, columns 9-17 and
+ * boxes 18-26. The search keeps, for every unit and digit, the number of
+ * cells of the unit that still have the digit, and updates it with every
+ * candidate removed. A cell left with one candidate is queued to be
+ * imposed on its peers, and a digit left with one place in a unit is
+ * queued to be placed there, so each step only visits what has changed
+ * instead of sweeping the grid until nothing does.
+ */
+
+#define ALL_UNITS 0x7ffffff
+#define LINE_UNITS 0x3ffff      // rows and columns
+
+static inline int box_unit(int i, int j)
+{
+    return 18 + (i / 3) * 3 + j / 3;
+}
+
+static inline uint32_t cell_units(int i, int j)
+{
+    return 1u << i | 1u << (9 + j) | 1u << box_unit(i, j);
+}
+
+static inline int ctz64(uint64_t x)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// Move cell c from by_size[from] to by_size[to]
+static inline void resize_cell(struct tallies *tl, int c, int from, int to)
+{
+    tl->by_size[from][c >> 6] &= ~(1ULL << (c & 63));
+    tl->by_size[to][c >> 6] |= 1ULL << (c & 63);
+}
+
+static inline void unit_cell(int u, int k, int *i, int *j)
+{
+    if (u < 9) {
+        *i = u;
+        *j = k;
+    } else if (u < 18) {
+        *i = k;
+        *j = u - 9;
+    } else {
+        *i = ((u - 18) / 3) * 3 + k / 3;
+        *j = ((u - 18) % 3) * 3 + k % 3;
+    }
+}
+
+static inline void remove_option(field_t number, sudoku_t field, int i, int j,
+                                 struct search *srch)
+{
+    struct tallies *tl = &srch->tally;
+    field_t removed = field[i][j] & number;
+    int units[3] = { i, 9 + j, box_unit(i, j) };
+    int c = i * 9 + j, before = tl->size[c];
+
+    if (removed == 0)
+        return;
+    _stat_add(srch->stats, eliminations, 1);
+    set_field(field, i, j, field[i][j] & ~number, srch);
+    srch->dirty |= cell_units(i, j);
+
+    for (; removed; removed &= removed - 1) {
+        int d = lowest_bit_index(removed);
+        for (int k=0; k<3; ++k) {
+            int left = --tl->counts[units[k]][d];
+            if (left == 1)
+                srch->hidden[srch->n_hidden++] = units[k] * 9 + d;
+            else if (left == 0)
+                srch->contradiction = true;
         }
+        tl->size[c]--;
+    }
+    resize_cell(tl, c, before, tl->size[c]);
+    if (before >= 2 && tl->size[c] <= 1) {
+        for (int k=0; k<3; ++k)
+            tl->open[units[k]]--;
     }
 
-    // check my corner!
+    if (field[i][j] == 0)
+        srch->contradiction = true;
+    else if (is_fixed(field[i][j]))
+        srch->fixed[srch->n_fixed++] = i * 9 + j;
+}
+
+// Remove the digit of the fixed cell [i,j] from its peers. The cells
+// this fixes are only queued.
+static void _impose(sudoku_t field, int i, int j, struct search *srch)
+{
+    field_t f = field[i][j];
+    if (!is_fixed(f)) return;
+    _stat_add(srch->stats, imposes, 1);
+
+    for (int k=0; k<9; ++k) {
+        if (k != j)
+            remove_option(f, field, i, k, srch);
+        if (k != i)
+            remove_option(f, field, k, j, srch);
+    }
+
+    // the rest of the box
     int origin1 = (i/3)*3;
     int origin2 = (j/3)*3;
-    for (k=origin1; k<origin1+3; ++k) {
-        for (l=origin2; l<origin2+3; ++l) {
-            if (k != i || l != j) {
-                bool was_fixed = is_fixed(field[k][l]);
-                remove_option(f, &field[k][l]);
-
-                if (recurse && !was_fixed && is_fixed(field[k][l])) {
-                    ii_now_fixed[newly_fixed_count] = k;
-                    jj_now_fixed[newly_fixed_count] = l;
-                    newly_fixed_count++;
-                }
-            }
+    for (int k=origin1; k<origin1+3; ++k) {
+        for (int l=origin2; l<origin2+3; ++l) {
+            if (k != i && l != j)
+                remove_option(f, field, k, l, srch);
         }
     }
+}
+
+// Fill srch->tally from the grid, with empty queues
+static void count_candidates(sudoku_t field, struct search *srch)
+{
+    struct tallies *tl = &srch->tally;
+
+    memset(tl, 0, sizeof(*tl));
+    srch->n_fixed = 0;
+    srch->n_hidden = 0;
+    srch->contradiction = false;
 
-    // Recursively fix new constraints
-    for (int m=0; m<newly_fixed_count; ++m) {
-        impose(field, ii_now_fixed[m], jj_now_fixed[m], true);
+    for (int i=0; i<9; ++i) {
+        for (int j=0; j<9; ++j) {
+            int c = i * 9 + j;
+            for (field_t f = field[i][j]; f; f &= f - 1) {
+                int d = lowest_bit_index(f);
+                tl->counts[i][d]++;
+                tl->counts[9 + j][d]++;
+                tl->counts[box_unit(i, j)][d]++;
+                tl->size[c]++;
+            }
+            tl->by_size[tl->size[c]][c >> 6] |= 1ULL << (c & 63);
+            if (tl->size[c] >= 2) {
+                tl->open[i]++;
+                tl->open[9 + j]++;
+                tl->open[box_unit(i, j)]++;
+            }
+        }
     }
 }
 
-static void iterate_sudoku(sudoku_t field)
+// Count the candidates and queue everything the grid already implies:
+// its fixed cells and the digits with a single place in some unit.
+static void start_propagation(sudoku_t field, struct search *srch)
 {
-    int i, j;
+    count_candidates(field, srch);
 
-    for (i=0; i<9; ++i) {
-        for (j=0; j<9; ++j) {
-            impose(field, i, j, false);
+    for (int i=0; i<9; ++i) {
+        for (int j=0; j<9; ++j) {
+            if (field[i][j] == 0)
+                srch->contradiction = true;
+            else if (is_fixed(field[i][j]))
+                srch->fixed[srch->n_fixed++] = i * 9 + j;
+        }
+    }
+    for (int u=0; u<27; ++u) {
+        for (int d=0; d<9; ++d) {
+            if (srch->tally.counts[u][d] == 1)
+                srch->hidden[srch->n_hidden++] = u * 9 + d;
+            else if (srch->tally.counts[u][d] == 0)
+                srch->contradiction = true;
         }
     }
 }
 
-static void iterate_elimination(sudoku_t field)
+inline void impose(sudoku_t field, int i, int j, bool recurse)
 {
-    int i, j, k, l;
+    struct solver_stats stats = { 0 };
+    struct search srch;
 
-    bool imposed_any;
+    init_search(&srch, &stats);
+    count_candidates(field, &srch);
+    _impose(field, i, j, &srch);
+    while (recurse && srch.n_fixed > 0) {
+        int c = srch.fixed[--srch.n_fixed];
+        _impose(field, c / 9, c % 9, &srch);
+    }
+}
 
-    do {
-        imposed_any = false;
-        for (i=0; i<9; ++i) {
-            for (j=0; j<9; ++j) {
-                if (is_fixed(field[i][j])) continue;
+// Naked and hidden singles: work through the queues until both are
+// empty. Returns false on a contradiction, with the queues cleared.
+static bool propagate_singles(sudoku_t field, struct search *srch)
+{
+    _stat_add(srch->stats, passes, 1);
 
-                // Go through the row, column, and corner.
-                // See if there is any number that can only be here.
-                field_t row_mask = 0, col_mask = 0, corner_mask = 0;
-                for (k=0; k<9; ++k) {
-                    if (k != j) row_mask |= field[i][k];
-                    if (k != i) col_mask |= field[k][j];
+    while (!srch->contradiction) {
+        if (srch->n_fixed > 0) {
+            int c = srch->fixed[--srch->n_fixed];
+            _impose(field, c / 9, c % 9, srch);
+        } else if (srch->n_hidden > 0) {
+            int u = srch->hidden[--srch->n_hidden] / 9;
+            int d = srch->hidden[srch->n_hidden] % 9;
+            if (srch->tally.counts[u][d] != 1)
+                continue;
+            for (int k=0; k<9; ++k) {
+                int i, j;
+                unit_cell(u, k, &i, &j);
+                if ((field[i][j] >> d) & 1) {
+                    remove_option(field[i][j] & ~(1 << d), field, i, j, srch);
+                    break;
                 }
+            }
+        } else {
+            return true;
+        }
+    }
 
-                field_t row_unique = field[i][j] & (~row_mask);
-                if (is_fixed(row_unique)) {
-                    field[i][j] = row_unique;
-                    impose(field, i, j, true);
-                    imposed_any = true;
-                    continue;
-                }
+    srch->n_fixed = 0;
+    srch->n_hidden = 0;
+    srch->contradiction = false;
+    return false;
+}
+
+/*
+ * Propagation above singles (--propagation). The techniques look at one
+ * unit at a time, and only the units whose cells changed since they
+ * were last looked at (the dirty ones) are visited again.
+ */
+
+// Remove the digits in drop from cell [i,j]; true if there were any
+static bool drop_candidates(sudoku_t field, int i, int j, field_t drop,
+                            struct search *srch)
+{
+    if (!(field[i][j] & drop))
+        return false;
+    remove_option(drop, field, i, j, srch);
+    return true;
+}
+
+// Locked candidates. In a box, a digit confined to one row or column
+// goes from the rest of that line (pointing); in a line, a digit
+// confined to one box goes from the rest of that box (claiming).
+static bool locked_candidates(sudoku_t field, int u, struct search *srch)
+{
+    field_t part[3] = { 0, 0, 0 }, cross[3] = { 0, 0, 0 };
+    bool changed = false;
+    int i, j;
+
+    // Fixed cells count too: a cell fixed by an earlier unit is only
+    // imposed on its peers when the queue gets to it
+    for (int k=0; k<9; ++k) {
+        unit_cell(u, k, &i, &j);
+        // boxes: part by row, cross by column; lines: part by box
+        part[k / 3] |= field[i][j];
+        cross[k % 3] |= field[i][j];
+    }
+
+    for (int m=0; m<3; ++m) {
+        field_t only = part[m] & ~(part[(m + 1) % 3] | part[(m + 2) % 3]);
+        field_t only_cross = cross[m]
+                             & ~(cross[(m + 1) % 3] | cross[(m + 2) % 3]);
 
-                field_t col_unique = field[i][j] & (~col_mask);
-                if (is_fixed(col_unique)) {
-                    field[i][j] = col_unique;
-                    impose(field, i, j, true);
-                    imposed_any = true;
+        if (u >= 18) {
+            int bi = ((u - 18) / 3) * 3, bj = ((u - 18) % 3) * 3;
+            for (int k=0; k<9; ++k) {
+                if (only && (k < bj || k >= bj + 3))
+                    changed |= drop_candidates(field, bi + m, k, only, srch);
+                if (only_cross && (k < bi || k >= bi + 3))
+                    changed |= drop_candidates(field, k, bj + m, only_cross,
+                                               srch);
+            }
+        } else if (only) {
+            // The box of the line's m-th segment, minus the line itself
+            int line = u < 9 ? u : u - 9;
+            for (int k=0; k<9; ++k) {
+                int a = (line / 3) * 3 + k / 3, b = m * 3 + k % 3;
+                if (a == line)
                     continue;
-                }
+                if (u < 9)
+                    changed |= drop_candidates(field, a, b, only, srch);
+                else
+                    changed |= drop_candidates(field, b, a, only, srch);
+            }
+        }
+    }
+    return changed;
+}
 
-                // check my corner!
-                int origin1 = (i/3)*3;
-                int origin2 = (j/3)*3;
-                for (k=origin1; k<origin1+3; ++k) {
-                    for (l=origin2; l<origin2+3; ++l) {
-                        if (k != i || l != j) {
-                            corner_mask |= field[k][l];
-                        }
-                    }
+// All sets of n (2 or 3) of the nine masks whose union has exactly n
+// bits, skipping masks with a single bit. Each set goes to chosen as a
+// bit mask of mask indices, its union to unions. Returns how many.
+static int find_subsets(const field_t *masks, int n, int *chosen,
+                        field_t *unions)
+{
+    int count = 0;
+
+    for (int a=0; a<9; ++a) {
+        int na = count_bits(masks[a]);
+        if (na < 2 || na > n)
+            continue;
+        for (int b=a+1; b<9; ++b) {
+            int nb = count_bits(masks[b]);
+            field_t ab = masks[a] | masks[b];
+            if (nb < 2 || nb > n || count_bits(ab) > n)
+                continue;
+            if (n == 2) {
+                chosen[count] = 1 << a | 1 << b;
+                unions[count++] = ab;
+                continue;
+            }
+            for (int c=b+1; c<9; ++c) {
+                int nc = count_bits(masks[c]);
+                field_t abc = ab | masks[c];
+                if (nc >= 2 && count_bits(abc) == 3) {
+                    chosen[count] = 1 << a | 1 << b | 1 << c;
+                    unions[count++] = abc;
                 }
+            }
+        }
+    }
+    return count;
+}
+
+// Naked subsets: n cells with only n digits between them keep those
+// digits from the other cells. Hidden subsets: n digits with only n
+// places keep the other digits out of those places.
+static bool subsets(sudoku_t field, int u, struct search *srch)
+{
+    int ci[9], cj[9], chosen[84];
+    field_t cells[9], places[9], unions[84];
+    bool changed = false;
+
+    for (int k=0; k<9; ++k) {
+        unit_cell(u, k, &ci[k], &cj[k]);
+        cells[k] = field[ci[k]][cj[k]];
+    }
+    for (int d=0; d<9; ++d) {
+        places[d] = 0;
+        for (int k=0; k<9; ++k)
+            places[d] |= ((cells[k] >> d) & 1) << k;
+    }
+
+    for (int n=2; n<=3; ++n) {
+        int found = find_subsets(cells, n, chosen, unions);
+        for (int m=0; m<found; ++m) {
+            for (int k=0; k<9; ++k) {
+                if (!((chosen[m] >> k) & 1))
+                    changed |= drop_candidates(field, ci[k], cj[k],
+                                               unions[m], srch);
+            }
+        }
+
+        found = find_subsets(places, n, chosen, unions);
+        for (int m=0; m<found; ++m) {
+            for (int k=0; k<9; ++k) {
+                if ((unions[m] >> k) & 1)
+                    changed |= drop_candidates(field, ci[k], cj[k],
+                                               0x1ff & ~chosen[m], srch);
+            }
+        }
+    }
+    return changed;
+}
+
+// X-wings: a digit with the same two places in two rows cannot go
+// anywhere else in those two columns, and the same with rows and columns
+// swapped.
+static bool x_wings(sudoku_t field, struct search *srch)
+{
+    bool changed = false;
 
-                field_t corner_unique = field[i][j] & (~corner_mask);
-                if (is_fixed(corner_unique)) {
-                    field[i][j] = corner_unique;
-                    impose(field, i, j, true);
-                    imposed_any = true;
+    for (int d=0; d<9; ++d) {
+        field_t bit = 1 << d;
+        for (int by_col=0; by_col<2; ++by_col) {
+            field_t pos[9];
+            for (int a=0; a<9; ++a) {
+                pos[a] = 0;
+                for (int b=0; b<9; ++b) {
+                    field_t f = by_col ? field[b][a] : field[a][b];
+                    if (f & bit)
+                        pos[a] |= 1 << b;
+                }
+            }
+            for (int a1=0; a1<9; ++a1) {
+                if (count_bits(pos[a1]) != 2)
                     continue;
+                for (int a2=a1+1; a2<9; ++a2) {
+                    if (pos[a2] != pos[a1])
+                        continue;
+                    for (int a=0; a<9; ++a) {
+                        if (a == a1 || a == a2)
+                            continue;
+                        for (int b=0; b<9; ++b) {
+                            if (!((pos[a1] >> b) & 1))
+                                continue;
+                            if (by_col)
+                                changed |= drop_candidates(field, b, a, bit,
+                                                           srch);
+                            else
+                                changed |= drop_candidates(field, a, b, bit,
+                                                           srch);
+                        }
+                    }
+                    if (changed)
+                        return true;
                 }
             }
         }
-    } while(imposed_any);
+    }
+    return false;
+}
+
+// One round of the techniques of srch->level over the dirty units, the
+// cheaper ones first. Returns as soon as a technique removed candidates,
+// so that singles run again before anything more expensive. The units
+// that were not finished stay dirty.
+static bool reduce(sudoku_t field, uint32_t dirty, struct search *srch)
+{
+    bool changed = false;
+
+    for (int u=0; u<27; ++u) {
+        if ((dirty >> u) & 1)
+            changed |= locked_candidates(field, u, srch);
+    }
+    if (!changed && srch->level >= PROPAGATE_SUBSETS) {
+        for (int u=0; u<27; ++u) {
+            if ((dirty >> u) & 1)
+                changed |= subsets(field, u, srch);
+        }
+    }
+    if (!changed && srch->level >= PROPAGATE_FISH && (dirty & LINE_UNITS))
+        changed = x_wings(field, srch);
+
+    if (changed)
+        srch->dirty |= dirty;
+    return changed;
+}
+
+// With this many cells waiting to be imposed, as at the root, a sweep of
+// the vector kernel over the whole grid beats working through the queue
+#define SWEEP_MIN_FIXED 8
+
+// Run the queued singles through the vector kernel where the CPU has one.
+// The kernel keeps no undo log and knows nothing of the tallies, so it is
+// left alone under a trail, and the tallies are counted again afterwards.
+// The grid is then at the singles fixed point, and the queues are empty.
+static void sweep_singles(sudoku_t field, struct search *srch)
+{
+    sudoku_t before;
+
+    if (srch->trail != NULL || srch->n_fixed < SWEEP_MIN_FIXED
+            || srch->contradiction)
+        return;
+    memcpy(before, field, sizeof(sudoku_t));
+    if (!simd_propagate(field, srch->stats))
+        return;
+
+    count_candidates(field, srch);
+    for (int i=0; i<9; ++i) {
+        for (int j=0; j<9; ++j) {
+            if (field[i][j] != before[i][j])
+                srch->dirty |= cell_units(i, j);
+            if (field[i][j] == 0)
+                srch->contradiction = true;
+        }
+    }
+    // The kernel stops at an empty cell, but not at a digit left without
+    // a place in some unit
+    for (int u=0; u<27; ++u) {
+        for (int d=0; d<9; ++d) {
+            if (srch->tally.counts[u][d] == 0)
+                srch->contradiction = true;
+        }
+    }
+}
+
+// Singles, then the techniques of srch->level until none of them finds
+// anything. Returns false on a contradiction.
+static bool propagate(sudoku_t field, struct search *srch)
+{
+    for (;;) {
+        sweep_singles(field, srch);
+        if (!propagate_singles(field, srch))
+            return false;
+        if (srch->level <= PROPAGATE_SINGLES)
+            return true;
+
+        uint32_t dirty = srch->dirty;
+        srch->dirty = 0;
+        if (dirty == 0 || check_solution(field) != SUDOKU_IN_PROGRESS)
+            return true;
+        if (!reduce(field, dirty, srch))
+            return true;
+    }
 }
 
 int check_solution(sudoku_t field)
@@ -157,31 +707,283 @@ int check_solution(sudoku_t field)
     else return SUDOKU_DONE;
 }
 
-static int _solve_more(sudoku_t s, bool check_unique,
-                      solution_collector collect, void *collect_arg);
+// What shall we guess? The earliest cell with the lowest number
+// of possibilities.
+bool choose_guess(sudoku_t s, int *gi, int *gj)
+{
+    int simplest_n_bits = 10;
+
+    for (int i=0; i<9; ++i) {
+        for (int j=0; j<9; ++j) {
+            int count = count_bits(s[i][j]);
+            if (count < simplest_n_bits && count > 1) {
+                simplest_n_bits = count;
+                *gi = i;
+                *gj = j;
+            }
+        }
+    }
+
+    return simplest_n_bits != 10;
+}
+
+/*
+ * Branching (--branching). A choice point either gives a cell each of
+ * its digits in turn or, with cell < 0, gives a digit each of its places
+ * in a unit in turn; options holds what is left to try, as digits or as
+ * bits in the unit_cell order of the unit. Either way the options
+ * exclude each other, so solutions are neither lost nor counted twice.
+ */
+
+struct branch {
+    int cell;
+    int unit, digit;
+    field_t options;
+};
+
+// Of the open cells with size candidates, the one whose row, column and
+// box have the most open cells between them: filling it constrains the
+// most of the rest of the grid.
+static int most_open_peers(const struct tallies *tl, int size)
+{
+    int best = -1, best_open = -1;
+
+    for (int w=0; w<2; ++w) {
+        for (uint64_t set = tl->by_size[size][w]; set; set &= set - 1) {
+            int c = 64 * w + ctz64(set), i = c / 9, j = c % 9;
+            int open = tl->open[i] + tl->open[9 + j]
+                       + tl->open[box_unit(i, j)];
+            if (open > best_open) {
+                best = c;
+                best_open = open;
+            }
+        }
+    }
+    return best;
+}
+
+// Choose the next choice point from the tallies. False if every cell is
+// fixed.
+static bool choose_branch(sudoku_t field, const struct search *srch,
+                          struct branch *b)
+{
+    const struct tallies *tl = &srch->tally;
+    int size = 2;
+
+    while (size <= 9 && !(tl->by_size[size][0] | tl->by_size[size][1]))
+        size++;
+    if (size > 9)
+        return false;
+
+    if (srch->branching == BRANCH_DEGREE)
+        b->cell = most_open_peers(tl, size);
+    else if (tl->by_size[size][0])
+        b->cell = ctz64(tl->by_size[size][0]);
+    else
+        b->cell = 64 + ctz64(tl->by_size[size][1]);
+    b->options = field[b->cell / 9][b->cell % 9];
+
+    if (srch->branching == BRANCH_PLACES && size > 2) {
+        // A digit that is not placed in a unit yet has at least two
+        // places there; look for one with fewer than the cell's digits
+        int fewest = size;
+        for (int u=0; u<27 && fewest > 2; ++u) {
+            for (int d=0; d<9; ++d) {
+                if (tl->counts[u][d] >= 2 && tl->counts[u][d] < fewest) {
+                    fewest = tl->counts[u][d];
+                    b->unit = u;
+                    b->digit = d;
+                }
+            }
+        }
+        if (fewest < size) {
+            b->cell = -1;
+            b->options = 0;
+            for (int k=0; k<9; ++k) {
+                int i, j;
+                unit_cell(b->unit, k, &i, &j);
+                b->options |= ((field[i][j] >> b->digit) & 1) << k;
+            }
+        }
+    }
+    return true;
+}
+
+// Take the next option out of b (at random for BRANCH_RANDOM, otherwise
+// the lowest) and apply it to the grid
+static void take_option(sudoku_t field, struct branch *b, struct search *srch)
+{
+    field_t options = b->options;
+
+    if (srch->branching == BRANCH_RANDOM) {
+        int skip = sudoku_rng_below(&srch->rng, count_bits(options));
+        for (; skip > 0; --skip)
+            options &= options - 1;
+    }
+    field_t pick = options & -options;
+    b->options &= ~pick;
+    _stat_add(srch->stats, guesses, 1);
+
+    if (b->cell >= 0) {
+        remove_option(~pick, field, b->cell / 9, b->cell % 9, srch);
+    } else {
+        int i, j;
+        unit_cell(b->unit, lowest_bit_index(pick), &i, &j);
+        remove_option(~(1 << b->digit), field, i, j, srch);
+    }
+}
+
+// Count a guess against the per-puzzle budget, which ends the search,
+// and against the restart budget of BRANCH_RANDOM, which starts it over
+static inline bool out_of_budget(struct search *srch)
+{
+    if (solver_budget_spent(srch->budget)) {
+        srch->stop = true;
+        return true;
+    }
+    if (srch->restart_after == 0 || ++srch->guesses <= srch->restart_after)
+        return false;
+    srch->restart = true;
+    srch->stop = true;
+    return true;
+}
+
+int propagate_sudoku(sudoku_t s)
+{
+    struct solver_stats stats = { 0 };
+    struct search srch;
+
+    init_search(&srch, &stats);
+    start_propagation(s, &srch);
+    if (!propagate(s, &srch))
+        return SUDOKU_ERROR;
+    return check_solution(s);
+}
+
+void solver_stats_add(struct solver_stats *total, const struct solver_stats *s)
+{
+    total->guesses += s->guesses;
+    total->backtracks += s->backtracks;
+    total->imposes += s->imposes;
+    total->eliminations += s->eliminations;
+    total->passes += s->passes;
+    if (s->max_depth > total->max_depth)
+        total->max_depth = s->max_depth;
+}
+
+// Report a solution; sets srch->stop when the search should end here
+static void found_solution(struct search *srch, sudoku_t s)
+{
+    srch->found++;
+    if (srch->collect != NULL && !(*srch->collect)(srch->collect_arg, s))
+        srch->stop = true;
+    if (srch->max_solutions > 0 && srch->found >= srch->max_solutions)
+        srch->stop = true;
+}
+
+static int _solve_more(sudoku_t s, struct search *srch, int depth);
+static int _solve_trail(sudoku_t s, struct search *srch, struct trail *t);
+
+struct trail *solver_trail_new(void)
+{
+    struct trail *t = malloc(sizeof(struct trail));
+
+    if (t == NULL)
+        return NULL;
+    t->n = 0;
+    t->generation = 1;
+    memset(t->stamp, 0, sizeof(t->stamp));
+    return t;
+}
+
+void solver_trail_free(struct trail *t)
+{
+    free(t);
+}
 
 int _solve(sudoku_t s, bool check_unique,
            solution_collector collect, void *collect_arg)
 {
+    return _solve_with(s, check_unique, collect, collect_arg, NULL);
+}
+
+int _solve_with(sudoku_t s, bool check_unique,
+                solution_collector collect, void *collect_arg,
+                const struct solver_options *opts)
+{
+    return _solve_engine(solver_engine, NULL, s, check_unique,
+                         collect, collect_arg, opts);
+}
+
+int _solve_engine(enum solver_engine engine, struct trail *trail,
+                  sudoku_t s, bool check_unique,
+                  solution_collector collect, void *collect_arg,
+                  const struct solver_options *opts)
+{
+    struct solver_stats scratch_stats = { 0 };
+    struct search srch;
+    sudoku_t start;
+
     _dbg("Solving:\n");
     _dbg_print_sudoku(s);
-    iterate_sudoku(s);
 
-    return _solve_more(s, check_unique, collect, collect_arg);
+    init_search(&srch, (opts && opts->stats) ? opts->stats : &scratch_stats);
+    srch.check_unique = check_unique;
+    srch.collect = collect;
+    srch.collect_arg = collect_arg;
+    srch.max_solutions = opts ? opts->max_solutions : 0;
+    srch.level = (opts && opts->propagation) ? opts->propagation
+                                             : solver_propagation;
+    srch.branching = (opts && opts->branching) ? opts->branching
+                                               : solver_branching;
+    srch.budget = opts ? opts->budget : NULL;
+
+    if (engine == ENGINE_BITBOARD)
+        return bitboard_solve(s, check_unique, collect, collect_arg, opts);
+    if (engine == ENGINE_DLX)
+        return dlx_solve(s, check_unique, collect, collect_arg, opts);
+
+    // Restarts only make sense while no solution has been reported
+    if (srch.branching == BRANCH_RANDOM && !check_unique) {
+        srch.restart_after = RESTART_GUESSES;
+        memcpy(start, s, sizeof(sudoku_t));
+    }
+
+    for (;;) {
+        int solutions;
+
+        srch.dirty = ALL_UNITS;
+        start_propagation(s, &srch);
+        if (engine == ENGINE_TRAIL)
+            solutions = _solve_trail(s, &srch, trail);
+        else
+            solutions = _solve_more(s, &srch, 0);
+        if (!srch.restart)
+            return solutions;
+
+        memcpy(s, start, sizeof(sudoku_t));
+        srch.restart = false;
+        srch.stop = false;
+        srch.guesses = 0;
+        srch.restart_after *= 2;
+    }
 }
 
-static int _solve_more(sudoku_t s, bool check_unique,
-                       solution_collector collect, void *collect_arg)
+static int _solve_more(sudoku_t s, struct search *srch, int depth)
 {
     sudoku_t buffer, a_solution;
+    struct tallies tally;
+    struct branch b;
 
-    iterate_elimination(s);
+    if (!propagate(s, srch)) {
+        _dbg("ERROR\n");
+        return 0;
+    }
 
     switch (check_solution(s)) {
         case SUDOKU_DONE:
             _dbg("DONE\n");
-            if (collect != NULL)
-                (*collect)(collect_arg, s);
+            found_solution(srch, s);
             return 1;
         case SUDOKU_ERROR:
             _dbg("ERROR\n");
@@ -191,62 +993,54 @@ static int _solve_more(sudoku_t s, bool check_unique,
     }
 
     memcpy(buffer, s, sizeof(sudoku_t));
+    memcpy(&tally, &srch->tally, sizeof(tally));
 
     // Guess something!
-    // What shall we guess?
-    int simplest_i = 0, simplest_j = 0;
-    int simplest_n_bits = 10;
-
-    for (int i=0; i<9; ++i) {
-        for (int j=0; j<9; ++j) {
-            int count = count_bits(buffer[i][j]);
-            if (count < simplest_n_bits && count > 1) {
-                simplest_n_bits = count;
-                simplest_i = i;
-                simplest_j = j;
-            }
-        }
-    }
-
-    if (simplest_n_bits == 10) {
+    if (!choose_branch(buffer, srch, &b)) {
         return 0;
     }
 
-    // We've selected the earliest point with the lowest number
-    // of possibilities. Try all.
+    // Try all the options of the choice point.
 
     int my_solutions_count = 0;
+    _stat_max(srch->stats, max_depth, depth + 1);
 
-    for (int i=0; i<9; ++i) {
-        if ((s[simplest_i][simplest_j] >> i) & 1) {
-            buffer[simplest_i][simplest_j] = (1 << i);
-            impose(buffer, simplest_i, simplest_j, true)
-
-            _dbg("HAVE \n");
-            _dbg_print_sudoku(s);
-            _dbg("GUESS \n");
-            _dbg_print_sudoku(buffer);
-            // The buffer now contains our guess
-            int solutions_here = _solve_more(buffer, check_unique,
-                                             collect, collect_arg);
-            if (solutions_here > 0) {
-                // done!
-                
-                if (!check_unique) {
-                    memcpy(s, buffer, sizeof(sudoku_t));
-                    return 1;
-                } else {
-                    my_solutions_count += solutions_here;
-                    memcpy(a_solution, buffer, sizeof(sudoku_t));
-                    // backtrack to find more solutions!
-                    memcpy(buffer, s, sizeof(sudoku_t));
-                }
+    while (b.options) {
+        if (out_of_budget(srch))
+            break;
+        // s is propagated as far as the level goes: only what the
+        // guess changes is dirty
+        srch->dirty = 0;
+        take_option(buffer, &b, srch);
+
+        _dbg("HAVE \n");
+        _dbg_print_sudoku(s);
+        _dbg("GUESS \n");
+        _dbg_print_sudoku(buffer);
+        // The buffer now contains our guess
+        int solutions_here = _solve_more(buffer, srch, depth + 1);
+        if (solutions_here > 0) {
+            // done!
+
+            if (!srch->check_unique) {
+                memcpy(s, buffer, sizeof(sudoku_t));
+                return 1;
             } else {
-                // backtrack!
+                my_solutions_count += solutions_here;
+                memcpy(a_solution, buffer, sizeof(sudoku_t));
+                // backtrack to find more solutions!
                 memcpy(buffer, s, sizeof(sudoku_t));
+                memcpy(&srch->tally, &tally, sizeof(tally));
             }
-            _dbg("... next guess\n");
+        } else {
+            // backtrack!
+            _stat_add(srch->stats, backtracks, 1);
+            memcpy(buffer, s, sizeof(sudoku_t));
+            memcpy(&srch->tally, &tally, sizeof(tally));
         }
+        if (srch->stop)
+            break;
+        _dbg("... next guess\n");
     }
 
     if (my_solutions_count == 0) {
@@ -258,3 +1052,128 @@ static int _solve_more(sudoku_t s, bool check_unique,
     return my_solutions_count;
 }
 
+// Choice point of the trail engine
+struct guess {
+    struct branch b;    // b.options: the options not tried yet
+    int trail_mark;     // trail length before the first guess here
+    int solutions_before;   // solutions found before the current guess
+};
+
+// Undo the changes logged since mark, counting the candidates that
+// come back
+static void undo_trail(sudoku_t s, struct search *srch, int mark)
+{
+    struct trail *t = srch->trail;
+    struct tallies *tl = &srch->tally;
+    field_t *cells = (field_t *) s;
+
+    while (t->n > mark) {
+        t->n--;
+        int c = t->entries[t->n].cell, i = c / 9, j = c % 9;
+        int before = tl->size[c];
+        field_t back = t->entries[t->n].old & ~cells[c];
+        cells[c] = t->entries[t->n].old;
+        for (; back; back &= back - 1) {
+            int d = lowest_bit_index(back);
+            tl->counts[i][d]++;
+            tl->counts[9 + j][d]++;
+            tl->counts[box_unit(i, j)][d]++;
+            tl->size[c]++;
+        }
+        resize_cell(tl, c, before, tl->size[c]);
+        if (before <= 1 && tl->size[c] >= 2) {
+            tl->open[i]++;
+            tl->open[9 + j]++;
+            tl->open[box_unit(i, j)]++;
+        }
+    }
+}
+
+// Same search as _solve_more, but on a single grid: changes below a
+// choice point are undone from the trail, and the recursion is replaced
+// by an explicit stack of choice points. A trail passed in by the caller
+// is reused as it is: its generation only moves on, so the stamps left
+// from earlier puzzles are simply stale.
+static int _solve_trail(sudoku_t s, struct search *srch, struct trail *shared)
+{
+    struct trail local;
+    struct trail *t = shared ? shared : &local;
+    struct guess stack[81];
+    int depth = 0;
+    sudoku_t a_solution;
+    int solutions_count = 0;
+    bool consistent;
+
+    t->n = 0;
+    if (shared == NULL) {
+        t->generation = 1;
+        memset(t->stamp, 0, sizeof(t->stamp));
+    }
+
+    // Nothing at the root will be undone
+    srch->trail = NULL;
+    consistent = propagate(s, srch);
+    srch->trail = t;
+
+    for (;;) {
+        switch (consistent ? check_solution(s) : SUDOKU_ERROR) {
+            case SUDOKU_DONE:
+                _dbg("DONE\n");
+                found_solution(srch, s);
+                if (!srch->check_unique)
+                    return 1;
+                solutions_count++;
+                memcpy(a_solution, s, sizeof(sudoku_t));
+                break;
+            case SUDOKU_ERROR:
+                _dbg("ERROR\n");
+                break;
+            default:
+                _dbg("CONTINUE\n");
+                if (choose_branch(s, srch, &stack[depth].b)) {
+                    stack[depth].trail_mark = t->n;
+                    stack[depth].solutions_before = -1;
+                    depth++;
+                    _stat_max(srch->stats, max_depth, depth);
+                }
+        }
+        if (srch->stop)
+            break;
+
+        // Backtrack to the deepest choice point with untried digits
+        while (depth > 0) {
+            struct guess *g = &stack[depth-1];
+            _stat_add(srch->stats, backtracks,
+                      g->solutions_before == solutions_count);
+            if (g->b.options != 0)
+                break;
+            depth--;
+        }
+        if (depth == 0)
+            break;
+
+        if (out_of_budget(srch))
+            break;
+
+        struct guess *g = &stack[depth-1];
+        undo_trail(s, srch, g->trail_mark);
+        g->solutions_before = solutions_count;
+
+        if (++t->generation == 0) {
+            memset(t->stamp, 0, sizeof(t->stamp));
+            t->generation = 1;
+        }
+
+        srch->dirty = 0;
+        take_option(s, &g->b, srch);
+        consistent = propagate(s, srch);
+    }
+
+    if (solutions_count == 0) {
+        _dbg("Dead end.\n");
+    } else {
+        memcpy(s, a_solution, sizeof(sudoku_t));
+    }
+
+    return solutions_count;
+}
@@ -8,12 +8,162 @@
 
 #include "sudoku.h"
 
-typedef void (*solution_collector)(void *p, sudoku_t s);
+#ifndef SOLVER_STATS
+#   define SOLVER_STATS 0
+#endif
+
+// Called for every solution found; return false to stop the search.
+typedef bool (*solution_collector)(void *p, sudoku_t s);
+
+// Search statistics, collected only when built with SOLVER_STATS=1
+struct solver_stats {
+    unsigned long guesses;          // branches tried
+    unsigned long backtracks;       // branches that led to no solution
+    unsigned long imposes;          // cells imposed on their peers
+    unsigned long eliminations;     // candidates removed from cells
+    unsigned long passes;           // passes of the elimination loop
+    int max_depth;                  // deepest nesting of guesses
+};
+
+#if SOLVER_STATS
+#   define _stat_add(stats, field, n) ((stats)->field += (n))
+#   define _stat_max(stats, field, n) \
+        do { if ((n) > (stats)->field) (stats)->field = (n); } while (0)
+#else
+#   define _stat_add(stats, field, n) ((void) (stats))
+#   define _stat_max(stats, field, n) ((void) (stats))
+#endif
+
+// How hard the classic and trail engines propagate before they guess.
+// Every level adds techniques to the ones before it.
+enum solver_propagation {
+    PROPAGATE_DEFAULT,  // solver_propagation
+    PROPAGATE_SINGLES,  // naked and hidden singles
+    PROPAGATE_LOCKED,   // locked candidates: pointing and claiming
+    PROPAGATE_SUBSETS,  // naked and hidden pairs and triples
+    PROPAGATE_FISH      // X-wings
+};
+
+// Level used when the options do not name one (PROPAGATE_SINGLES)
+extern enum solver_propagation solver_propagation;
+
+bool solver_propagation_from_name(const char *name,
+                                  enum solver_propagation *level);
+
+// What the classic and trail engines guess on when propagation is stuck
+enum solver_branching {
+    BRANCH_DEFAULT,     // solver_branching
+    BRANCH_FIRST,       // the first cell with the fewest candidates
+    BRANCH_DEGREE,      // the same, ties to the cell with most open peers
+    BRANCH_PLACES,      // that cell, or a digit with fewer places left
+                        // in some unit
+    BRANCH_RANDOM       // the first cell, its digits in random order, and
+                        // restarts with a growing budget of guesses when
+                        // only one solution is wanted
+};
+
+// Branching used when the options do not name one (BRANCH_FIRST)
+extern enum solver_branching solver_branching;
+
+bool solver_branching_from_name(const char *name,
+                                enum solver_branching *branching);
+
+// A cap on the work spent on one puzzle. Every engine counts its
+// guesses against it and stops once it is spent, as if the collector
+// had said so: the count it returns is then only a lower bound, and
+// exceeded is set. Start it with solver_budget_start before each puzzle.
+struct solver_budget {
+    unsigned long max_nodes;        // guesses (0: no limit)
+    double max_seconds;             // wall-clock time (0: no limit)
+    bool exceeded;                  // the search gave up
+    unsigned long nodes;            // guesses made so far
+    double deadline;                // solver_clock() at which time is up
+    bool shared;                    // charged by several threads at once
+};
+
+// Seconds on a monotonic clock
+double solver_clock(void);
+
+void solver_budget_start(struct solver_budget *b);
+
+// solver_budget_spent for a shared budget, with atomic updates
+bool _solver_budget_spent_shared(struct solver_budget *b);
+
+// Time is only looked at every this many guesses
+#define SOLVER_BUDGET_CLOCK_EVERY 256
+
+// Charge one guess; true, and the guess is not to be made or counted,
+// once the budget is spent. b may be NULL.
+static inline bool solver_budget_spent(struct solver_budget *b)
+{
+    if (b == NULL)
+        return false;
+    if (b->shared)
+        return _solver_budget_spent_shared(b);
+    if (b->exceeded)
+        return true;
+    if (b->max_nodes > 0 && b->nodes >= b->max_nodes)
+        b->exceeded = true;
+    else if (b->max_seconds > 0 && b->nodes % SOLVER_BUDGET_CLOCK_EVERY == 0
+             && solver_clock() >= b->deadline)
+        b->exceeded = true;
+    else
+        b->nodes++;
+    return b->exceeded;
+}
+
+struct solver_options {
+    struct solver_stats *stats;     // add the statistics here (or NULL)
+    int max_solutions;              // stop after this many (0: no limit)
+    enum solver_propagation propagation;
+    enum solver_branching branching;
+    struct solver_budget *budget;   // NULL: no limit
+};
+
+enum solver_engine {
+    ENGINE_CLASSIC,     // propagate-and-guess on the per-cell grid
+    ENGINE_TRAIL,       // the same search with an undo trail, no recursion
+    ENGINE_BITBOARD,    // per-digit 81-bit boards (default)
+    ENGINE_DLX          // exact cover with dancing links
+};
+
+// Engine used by _solve and everything built on it
+extern enum solver_engine solver_engine;
+
+bool solver_engine_from_name(const char *name, enum solver_engine *engine);
 
 bool all_are_fixed(sudoku_t field);
 int check_solution(sudoku_t field);
 int _solve(sudoku_t s, bool check_unique,
            solution_collector collect, void *collect_arg);
+int _solve_with(sudoku_t s, bool check_unique,
+                solution_collector collect, void *collect_arg,
+                const struct solver_options *opts);
+
+// Undo log of the trail engine. Callers that solve many puzzles can
+// allocate one up front and hand it to _solve_engine.
+struct trail;
+struct trail *solver_trail_new(void);
+void solver_trail_free(struct trail *t);
+
+// _solve_with with an explicit engine instead of solver_engine. The trail
+// engine uses trail if it is not NULL, or a fresh one on the stack.
+int _solve_engine(enum solver_engine engine, struct trail *trail,
+                  sudoku_t s, bool check_unique,
+                  solution_collector collect, void *collect_arg,
+                  const struct solver_options *opts);
+
+int _solve_parallel(sudoku_t s, bool check_unique,
+                    solution_collector collect, void *collect_arg,
+                    const struct solver_options *opts, int n_threads);
+
+void solver_stats_add(struct solver_stats *total, const struct solver_stats *s);
+
+// Building blocks for splitting the search: propagate_sudoku runs the
+// classic constraint propagation and returns check_solution of the
+// result; choose_guess picks the cell _solve_more would branch on.
+int propagate_sudoku(sudoku_t s);
+bool choose_guess(sudoku_t s, int *gi, int *gj);
 
 extern void impose(sudoku_t field, int i, int j, bool recurse);
 
@@ -27,10 +177,35 @@ static inline int count_sudoku_solutions(sudoku_t s)
     return _solve(s, true, NULL, NULL);
 }
 
+// Count the solutions, but stop at limit: a uniqueness check only needs
+// to know whether there is a second one.
+static inline int count_sudoku_solutions_upto(sudoku_t s, int limit)
+{
+    struct solver_options opts = { NULL, limit, PROPAGATE_DEFAULT,
+                                   BRANCH_DEFAULT, NULL };
+    return _solve_with(s, true, NULL, NULL, &opts);
+}
+
 static inline int collect_all_solutions(
     sudoku_t s, solution_collector collect, void *arg)
 {
     return _solve(s, true, collect, arg);
 }
 
+static inline int count_sudoku_solutions_parallel(sudoku_t s, int n_threads)
+{
+    return _solve_parallel(s, true, NULL, NULL, NULL, n_threads);
+}
+
+// The collector is called from one thread at a time, but not necessarily
+// the calling thread, and the solutions come in no particular order.
+// Collection is serialized by design, under one lock, so collectors need
+// not be thread safe; workers hand their solutions over in batches to
+// keep that lock cold.
+static inline int collect_all_solutions_parallel(
+    sudoku_t s, solution_collector collect, void *arg, int n_threads)
+{
+    return _solve_parallel(s, true, collect, arg, NULL, n_threads);
+}
+
 #endif /* _SUDOKU_SOLVER_H */
@@ -1,5 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "sudoku.h"
 
 bool all_are_fixed(sudoku_t field)
@@ -27,40 +34,101 @@ void fill_bits(const int number_field[9][9], sudoku_t bit_field)
 }
 
 
-void print_sudoku(sudoku_t field, bool short_format)
+int format_sudoku(char *buf, sudoku_t field, bool short_format)
 {
     int i, j;
+    char *p = buf;
 
-    for (i=0; i<9; ++i) {
-        for (j=0; j<9; ++j) {
-            int n = bits2number(field[i][j]);
-            switch(n) {
-                case -1:
-                    putchar('E');
-                    break;
-                case 0:
-                    putchar('.');
-                    break;
-                case 1: 
-                case 2: 
-                case 3: 
-                case 4: 
-                case 5: 
-                case 6: 
-                case 7: 
-                case 8: 
-                case 9:
-                    printf("%d", n);
-                    break;
-                default:
-                    putchar('!');
-                    break;
+    if (short_format) {
+        for (i=0; i<9; ++i)
+            for (j=0; j<9; ++j)
+                *(p++) = cell_char(field[i][j]);
+    } else {
+        for (i=0; i<9; ++i) {
+            for (j=0; j<9; ++j) {
+                *(p++) = cell_char(field[i][j]);
+                *(p++) = (j != 8) ? ' ' : '\n';
             }
-            if (!short_format && j != 8)
-                putchar(' ');
         }
-        if (!short_format) putchar('\n');
     }
+    return p - buf;
+}
+
+void print_sudoku(sudoku_t field, bool short_format)
+{
+    char buf[SUDOKU_FORMAT_MAX];
+    fwrite(buf, 1, format_sudoku(buf, field, short_format), stdout);
+}
+
+void sudoku_writer_init(struct sudoku_writer *w, FILE *sink)
+{
+    w->buf = NULL;
+    w->len = w->size = 0;
+    w->sink = sink;
+}
+
+void sudoku_writer_free(struct sudoku_writer *w)
+{
+    free(w->buf);
+    w->buf = NULL;
+    w->len = w->size = 0;
+}
+
+void _sudoku_writer_grow(struct sudoku_writer *w, size_t n)
+{
+    w->size = 2 * (w->len + n);
+    if (w->size < SUDOKU_WRITER_FLUSH_SIZE && w->sink != NULL)
+        w->size = 2 * SUDOKU_WRITER_FLUSH_SIZE;
+    w->buf = realloc(w->buf, w->size);
+}
+
+void sudoku_writer_flush(struct sudoku_writer *w)
+{
+    if (w->sink == NULL)
+        return;
+    if (w->len > 0)
+        fwrite(w->buf, 1, w->len, w->sink);
+    fflush(w->sink);
+    w->len = 0;
+}
+
+void sudoku_writer_printf(struct sudoku_writer *w, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    sudoku_writer_reserve(w, n + 1);
+    va_start(ap, fmt);
+    vsnprintf(w->buf + w->len, n + 1, fmt, ap);
+    va_end(ap);
+    w->len += n;
+}
+
+// Parse "n", "a-b", "a-" or "-b"; a missing end leaves the default alone
+bool parse_range(const char *arg, long *lo, long *hi)
+{
+    char *end;
+    const char *dash = strchr(arg, '-');
+
+    if (dash == NULL) {
+        *lo = *hi = strtol(arg, &end, 10);
+        return end != arg && *end == '\0';
+    }
+    if (dash != arg) {
+        *lo = strtol(arg, &end, 10);
+        if (end != dash)
+            return false;
+    }
+    if (dash[1] != '\0') {
+        *hi = strtol(dash + 1, &end, 10);
+        if (*end != '\0')
+            return false;
+    }
+    return true;
 }
 
 static inline field_t *insert_from_char(field_t *field_p, char c)
@@ -105,6 +173,327 @@ int fill_sudoku_from_file(sudoku_t field, FILE *fp)
     return field_p - ((field_t*) field);
 }
 
+static inline void put_le(uint8_t *p, uint64_t x, int n)
+{
+    for (int k=0; k<n; ++k)
+        p[k] = x >> (8 * k);
+}
+
+static inline uint64_t get_le(const uint8_t *p, int n)
+{
+    uint64_t x = 0;
+    for (int k=n-1; k>=0; --k)
+        x = (x << 8) | p[k];
+    return x;
+}
+
+void pack_sudoku(sudoku_t field, uint8_t *packed)
+{
+    const field_t *cells = (const field_t *) field;
+
+    memset(packed, 0, SUDOKU_PACKED_SIZE);
+    for (int c=0; c<81; ++c) {
+        int n = is_fixed(cells[c]) ? lowest_bit_index(cells[c]) + 1 : 0;
+        packed[c / 2] |= n << (4 * (c & 1));
+    }
+}
+
+// Nibbles that are not digits come out as empty cells
+void unpack_sudoku(const uint8_t *packed, sudoku_t field)
+{
+    field_t *cells = (field_t *) field;
+
+    for (int c=0; c<80; c+=2) {
+        cells[c] = number2bits(packed[c / 2] & 15);
+        cells[c + 1] = number2bits(packed[c / 2] >> 4);
+    }
+    cells[80] = number2bits(packed[40] & 15);
+}
+
+size_t sudoku_corpus_record_size(int flags)
+{
+    size_t n = SUDOKU_PACKED_SIZE;
+    if (flags & SUDOKU_CORPUS_SOLUTION)
+        n += SUDOKU_PACKED_SIZE;
+    if (flags & SUDOKU_CORPUS_COUNT)
+        n += 4;
+    return n;
+}
+
+void sudoku_corpus_header(uint8_t *header, int flags, uint64_t n_records)
+{
+    memset(header, 0, SUDOKU_CORPUS_HEADER_SIZE);
+    memcpy(header, SUDOKU_CORPUS_MAGIC, 8);
+    header[8] = SUDOKU_CORPUS_VERSION;
+    header[9] = flags;
+    put_le(header + 10, sudoku_corpus_record_size(flags), 2);
+    put_le(header + 16, n_records, 8);
+}
+
+void sudoku_writer_record(struct sudoku_writer *w, int flags, sudoku_t puzzle,
+                          sudoku_t solution, int count)
+{
+    sudoku_writer_reserve(w, sudoku_corpus_record_size(flags));
+    uint8_t *p = (uint8_t *) w->buf + w->len;
+
+    pack_sudoku(puzzle, p);
+    p += SUDOKU_PACKED_SIZE;
+    if (flags & SUDOKU_CORPUS_SOLUTION) {
+        if (solution)
+            pack_sudoku(solution, p);
+        else
+            memset(p, 0, SUDOKU_PACKED_SIZE);
+        p += SUDOKU_PACKED_SIZE;
+    }
+    if (flags & SUDOKU_CORPUS_COUNT) {
+        put_le(p, (uint32_t) count, 4);
+        p += 4;
+    }
+    w->len = p - (uint8_t *) w->buf;
+}
+
+int64_t sudoku_corpus_begin(FILE *fp, int flags, uint64_t n_records)
+{
+    uint8_t header[SUDOKU_CORPUS_HEADER_SIZE];
+    off_t start = ftello(fp);
+
+    sudoku_corpus_header(header, flags, n_records);
+    if (fwrite(header, 1, sizeof(header), fp) != sizeof(header))
+        return -1;
+    return start < 0 ? 0 : start;
+}
+
+bool sudoku_corpus_finish(FILE *fp, int64_t start, int flags)
+{
+    uint8_t n[8];
+    off_t end;
+
+    if (fflush(fp) != 0 || (end = ftello(fp)) < 0)
+        return false;
+
+    put_le(n, (end - start - SUDOKU_CORPUS_HEADER_SIZE)
+              / sudoku_corpus_record_size(flags), 8);
+    if (fseeko(fp, start + 16, SEEK_SET) != 0)
+        return false;
+    fwrite(n, 1, sizeof(n), fp);
+    fseeko(fp, end, SEEK_SET);
+    return fflush(fp) == 0;
+}
+
+#define READER_BLOCK_SIZE (1 << 20)
+#define CHAR_SPACE 10
+
+// The value of each input byte for the bulk reader: 1-9 for the digits,
+// CHAR_SPACE for whitespace, and 0 (an empty cell) for everything else,
+// just like insert_from_char in the C locale.
+static const uint8_t char_number[256] = {
+    ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4, ['5'] = 5,
+    ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+    [' '] = CHAR_SPACE, ['\t'] = CHAR_SPACE, ['\n'] = CHAR_SPACE,
+    ['\v'] = CHAR_SPACE, ['\f'] = CHAR_SPACE, ['\r'] = CHAR_SPACE,
+};
+
+// Make sure there is at least one unread byte, if the input has any
+static inline bool reader_fill(struct sudoku_reader *r)
+{
+    if (r->pos < r->len)
+        return true;
+    if (r->mapped)
+        return false;
+
+    r->len = fread(r->block, 1, READER_BLOCK_SIZE, r->fp);
+    r->pos = 0;
+    return r->len > 0;
+}
+
+// Check for the header of a binary corpus. A corpus in a version or with
+// a layout we do not know reads as empty.
+static void reader_detect_corpus(struct sudoku_reader *r)
+{
+    if (!reader_fill(r) || r->len - r->pos < SUDOKU_CORPUS_HEADER_SIZE)
+        return;
+
+    const uint8_t *h = r->data + r->pos;
+    if (memcmp(h, SUDOKU_CORPUS_MAGIC, 8) != 0)
+        return;
+
+    r->binary = true;
+    r->pos += SUDOKU_CORPUS_HEADER_SIZE;
+    r->flags = h[9];
+    r->record_size = get_le(h + 10, 2);
+    r->n_records = get_le(h + 16, 8);
+    if (h[8] != SUDOKU_CORPUS_VERSION
+            || r->record_size != sudoku_corpus_record_size(r->flags)) {
+        r->left = 0;
+        return;
+    }
+
+    // Trust the file size over the header
+    if (r->mapped) {
+        uint64_t n = (r->len - r->pos) / r->record_size;
+        if (n < r->n_records)
+            r->n_records = n;
+    }
+}
+
+struct sudoku_reader *sudoku_reader_open(FILE *fp)
+{
+    struct sudoku_reader *r = malloc(sizeof(struct sudoku_reader));
+    struct stat st;
+    int fd = fileno(fp);
+    off_t offset = ftello(fp);
+
+    if (r == NULL)
+        return NULL;
+    r->fp = fp;
+    r->data = NULL;
+    r->block = NULL;
+    r->len = r->pos = 0;
+    r->mapped = false;
+    r->binary = false;
+    r->flags = 0;
+    r->record_size = 0;
+    r->n_records = 0;
+    r->left = UINT64_MAX;
+
+    // Map regular files; everything else is read in large blocks
+    if (fd >= 0 && offset >= 0 && fstat(fd, &st) == 0
+            && S_ISREG(st.st_mode) && st.st_size > offset) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+            r->data = data;
+            r->len = st.st_size;
+            r->pos = offset;
+            r->mapped = true;
+            reader_detect_corpus(r);
+            return r;
+        }
+    }
+
+    r->block = malloc(READER_BLOCK_SIZE);
+    if (r->block == NULL) {
+        free(r);
+        return NULL;
+    }
+    r->data = r->block;
+    reader_detect_corpus(r);
+    return r;
+}
+
+static int reader_next_text(struct sudoku_reader *r, sudoku_t field)
+{
+    field_t *field_p = (field_t *) field;
+    field_t *end = field_p + 81;
+
+    clear_sudoku(field);
+
+    while (field_p != end && reader_fill(r)) {
+        const unsigned char *p = r->data + r->pos;
+        const unsigned char *data_end = r->data + r->len;
+
+        while (field_p != end && p != data_end) {
+            int n = char_number[*(p++)];
+            if (n != CHAR_SPACE)
+                *(field_p++) = number2bits(n);
+        }
+        r->pos = p - r->data;
+    }
+
+    // Like fill_sudoku_from_file, swallow the character after the puzzle
+    if (field_p == end && reader_fill(r))
+        r->pos++;
+
+    return field_p - ((field_t*) field);
+}
+
+// The next record of a binary corpus, in place if it lies in one piece,
+// or NULL at the end of the input
+static const uint8_t *reader_record(struct sudoku_reader *r)
+{
+    size_t n = r->record_size, have = 0;
+
+    if (r->len - r->pos >= n) {
+        r->pos += n;
+        return r->data + r->pos - n;
+    }
+
+    // Split between two blocks
+    while (have < n && reader_fill(r)) {
+        size_t k = r->len - r->pos;
+        if (k > n - have)
+            k = n - have;
+        memcpy(r->record + have, r->data + r->pos, k);
+        have += k;
+        r->pos += k;
+    }
+    return have == n ? r->record : NULL;
+}
+
+// Like sudoku_reader_next; solution and count (either may be NULL) get
+// the solution and count stored in a binary corpus, or an empty grid and
+// -1 where the input has none.
+int sudoku_reader_next_record(struct sudoku_reader *r, sudoku_t field,
+                              sudoku_t solution, int *count)
+{
+    const uint8_t *rec = NULL;
+
+    if (solution)
+        clear_sudoku(solution);
+    if (count)
+        *count = -1;
+
+    if (r->left == 0 || (r->binary && (rec = reader_record(r)) == NULL)) {
+        clear_sudoku(field);
+        return 0;
+    }
+    r->left--;
+    if (!r->binary)
+        return reader_next_text(r, field);
+
+    unpack_sudoku(rec, field);
+    rec += SUDOKU_PACKED_SIZE;
+    if (r->flags & SUDOKU_CORPUS_SOLUTION) {
+        if (solution)
+            unpack_sudoku(rec, solution);
+        rec += SUDOKU_PACKED_SIZE;
+    }
+    if ((r->flags & SUDOKU_CORPUS_COUNT) && count)
+        *count = (int32_t) get_le(rec, 4);
+    return 81;
+}
+
+// Skip the first puzzles and stop after n more, e.g. to work on one shard
+// of a corpus. Binary corpora in regular files skip without reading.
+void sudoku_reader_select(struct sudoku_reader *r, uint64_t first, uint64_t n)
+{
+    sudoku_t scratch;
+
+    if (r->binary && r->mapped) {
+        uint64_t avail = (r->len - r->pos) / r->record_size;
+        r->pos += (first < avail ? first : avail) * r->record_size;
+    } else {
+        r->left = UINT64_MAX;
+        for (uint64_t k=0; k<first; ++k)
+            if (sudoku_reader_next_record(r, scratch, NULL, NULL) == 0)
+                break;
+    }
+    r->left = n;
+}
+
+int sudoku_reader_next(struct sudoku_reader *r, sudoku_t field)
+{
+    return sudoku_reader_next_record(r, field, NULL, NULL);
+}
+
+void sudoku_reader_close(struct sudoku_reader *r)
+{
+    if (r->mapped)
+        munmap((void *) r->data, r->len);
+    free(r->block);
+    free(r);
+}
+
 void clear_sudoku(sudoku_t field)
 {
     for (int i=0; i<9; ++i) {
@@ -21,6 +21,10 @@
 typedef uint16_t field_t;
 typedef field_t sudoku_t[9][9];
 
+// Longest output of format_sudoku: 9 rows of 9 cells, 8 spaces and a newline
+#define SUDOKU_FORMAT_MAX (9 * 18)
+
+int format_sudoku(char *buf, sudoku_t field, bool short_format);
 void print_sudoku(sudoku_t field, bool short_format);
 bool all_are_fixed(sudoku_t field);
 void fill_bits(const int number_field[9][9], sudoku_t bit_field);
@@ -28,42 +32,121 @@ void fill_bits(const int number_field[9][9], sudoku_t bit_field);
 int fill_sudoku_from_string(sudoku_t field, char *s);
 int fill_sudoku_from_file(sudoku_t field, FILE *fp);
 
+bool parse_range(const char *arg, long *lo, long *hi);
+
+// Binary corpus: a header followed by fixed-size records, so record k
+// starts at SUDOKU_CORPUS_HEADER_SIZE + k * record size. A record is the
+// puzzle with four bits per cell (0 for an empty cell, the low nibble
+// first), then optionally the solution packed the same way (all zero if
+// there is none) and the solution count as a 32-bit little-endian int,
+// SUDOKU_COUNT_TIMEOUT if the search gave up.
+//
+// Header: the magic, then version, flags, record size (16 bits) and
+// four zero bytes, then the number of records (64 bits), or
+// SUDOKU_CORPUS_UNKNOWN when the writer could not seek back to fill it
+// in. All numbers are little-endian.
+#define SUDOKU_CORPUS_MAGIC "\x89SUDOKU\n"
+#define SUDOKU_CORPUS_VERSION 1
+#define SUDOKU_CORPUS_HEADER_SIZE 24
+#define SUDOKU_CORPUS_UNKNOWN UINT64_MAX
+
+#define SUDOKU_CORPUS_SOLUTION 1
+#define SUDOKU_CORPUS_COUNT 2
+
+#define SUDOKU_COUNT_TIMEOUT (-1)
+
+#define SUDOKU_PACKED_SIZE 41
+
+void pack_sudoku(sudoku_t field, uint8_t *packed);
+void unpack_sudoku(const uint8_t *packed, sudoku_t field);
+size_t sudoku_corpus_record_size(int flags);
+void sudoku_corpus_header(uint8_t *header, int flags, uint64_t n_records);
+
+// Bulk input: maps regular files into memory and reads anything else
+// (pipes, terminals) in large blocks. sudoku_reader_next follows the
+// same rules and returns the same count as fill_sudoku_from_file.
+// Binary corpora are recognized by their header and read the same way;
+// every record counts as 81 cells.
+struct sudoku_reader {
+    FILE *fp;
+    const unsigned char *data;
+    size_t len, pos;
+    bool mapped;
+    unsigned char *block;
+
+    bool binary;
+    int flags;                  // SUDOKU_CORPUS_* of a binary corpus
+    size_t record_size;
+    uint64_t n_records;         // in a binary corpus, if known
+    uint64_t left;              // puzzles still to return
+    unsigned char record[2 * SUDOKU_PACKED_SIZE + 4];
+};
+
+// NULL if there is no memory for the reader
+struct sudoku_reader *sudoku_reader_open(FILE *fp);
+int sudoku_reader_next(struct sudoku_reader *r, sudoku_t field);
+int sudoku_reader_next_record(struct sudoku_reader *r, sudoku_t field,
+                              sudoku_t solution, int *count);
+void sudoku_reader_select(struct sudoku_reader *r, uint64_t first,
+                          uint64_t n);
+void sudoku_reader_close(struct sudoku_reader *r);
+
 void clear_sudoku(sudoku_t field);
 
+// Bulk output: text is collected in one large buffer and handed to the
+// sink in big chunks. A writer without a sink only collects.
+#define SUDOKU_WRITER_FLUSH_SIZE (1 << 20)
+
+struct sudoku_writer {
+    char *buf;
+    size_t len, size;
+    FILE *sink;
+};
+
+void sudoku_writer_init(struct sudoku_writer *w, FILE *sink);
+void sudoku_writer_free(struct sudoku_writer *w);
+void sudoku_writer_flush(struct sudoku_writer *w);
+void sudoku_writer_printf(struct sudoku_writer *w, const char *fmt, ...);
+void sudoku_writer_record(struct sudoku_writer *w, int flags, sudoku_t puzzle,
+                          sudoku_t solution, int count);
+
+// Write the header of a binary corpus to fp and return where it starts
+// (-1 on error). sudoku_corpus_finish fills in the number of records once
+// they have all been written, if fp can seek.
+int64_t sudoku_corpus_begin(FILE *fp, int flags, uint64_t n_records);
+bool sudoku_corpus_finish(FILE *fp, int64_t start, int flags);
+void _sudoku_writer_grow(struct sudoku_writer *w, size_t n);
+
 static inline bool is_fixed(field_t number)
 {
-    int i;
-    for (i=0; i<9; ++i) {
-        if (number == 1)
-            return true;
-        else if (number & 1)
-            return false;
-        else
-            number >>= 1;
-    }
+    // exactly one of the nine low bits is set
+    return number != 0 && (number & (number - 1)) == 0 && number < 0x200;
+}
 
-    return false;
+static inline int lowest_bit_index(field_t bits)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(bits);
+#else
+    int n = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        n++;
+    }
+    return n;
+#endif
 }
 
 static inline int bits2number(field_t bits)
 {
-    int n;
-
-    if (bits == 0) {
+    if (bits == 0)
         return -1;
-    } else {
-        for (n=1; n<=9; ++n) {
-            if (bits == 1) {
-                return n;
-                break;
-            } else if (bits & 1) {
-                return 0;
-                break;
-            }
-            bits >>= 1;
-        }
-    }
-    return -2;
+    else if (bits & (bits - 1))
+        return 0;
+    else if (bits >= 0x200)
+        return -2;
+    else
+        return lowest_bit_index(bits) + 1;
 }
 
 static inline field_t number2bits(int n)
@@ -76,12 +159,83 @@ static inline field_t number2bits(int n)
 
 static inline int count_bits(field_t f)
 {
+#ifdef __GNUC__
+    return __builtin_popcount(f & 0x1ff);
+#else
     int count = 0;
     for (int i=0; i<9; ++i) {
         if (f & 1) count++;
         f >>= 1;
     }
     return count;
+#endif
+}
+
+static inline char cell_char(field_t f)
+{
+    if (is_fixed(f))
+        return '1' + lowest_bit_index(f);
+    else if (f == 0)
+        return 'E';     // contradiction
+    else if (f & (f - 1))
+        return '.';     // undecided
+    else
+        return '!';     // garbage
+}
+
+static inline void sudoku_writer_reserve(struct sudoku_writer *w, size_t n)
+{
+    if (w->len + n > w->size)
+        _sudoku_writer_grow(w, n);
+}
+
+// Flush once enough text has piled up
+static inline void sudoku_writer_poll(struct sudoku_writer *w)
+{
+    if (w->len >= SUDOKU_WRITER_FLUSH_SIZE)
+        sudoku_writer_flush(w);
+}
+
+static inline void sudoku_writer_write(struct sudoku_writer *w,
+                                       const char *s, size_t n)
+{
+    sudoku_writer_reserve(w, n);
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+// s followed by a newline, like puts
+static inline void sudoku_writer_puts(struct sudoku_writer *w, const char *s)
+{
+    size_t n = strlen(s);
+    sudoku_writer_reserve(w, n + 1);
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+    w->buf[w->len++] = '\n';
+}
+
+// Like printf("%d", n)
+static inline void sudoku_writer_int(struct sudoku_writer *w, int n)
+{
+    char digits[12];
+    int k = sizeof(digits);
+    unsigned u = n < 0 ? -(unsigned) n : (unsigned) n;
+
+    do {
+        digits[--k] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (n < 0)
+        digits[--k] = '-';
+
+    sudoku_writer_write(w, digits + k, sizeof(digits) - k);
+}
+
+static inline void sudoku_writer_sudoku(struct sudoku_writer *w,
+                                        sudoku_t field, bool short_format)
+{
+    sudoku_writer_reserve(w, SUDOKU_FORMAT_MAX);
+    w->len += format_sudoku(w->buf + w->len, field, short_format);
 }
 
 static inline int sudoku_cmp(sudoku_t s1, sudoku_t s2)
@@ -1,21 +1,67 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 #include "sudoku.h"
 #include "solver.h"
+#include "cache.h"
+#include "simd.h"
+#include "grid.h"
 
 static bool all_solutions = false;
 static bool count_solutions = true;
 static bool short_output = false;
 static int timeit_iters = 0;
+static int n_threads = 0;
+static int search_threads = 1;
+static bool print_stats = false;
+static int max_solutions = 0;
+static bool stream_solutions = false;
+static struct solution_cache *cache = NULL;
+static bool binary_output = false;
+static int corpus_flags = 0;
+static bool convert_only = false;
+static long range_first = 0, range_last = -1;
+static int grid_box = 3;        // --size; 3 takes the 9x9 code
+static struct solver_budget limits;     // --time-limit, --guess-limit
+
+static bool process_file(FILE *fp);
+static bool process_sudoku_file(FILE *fp);
+static bool convert_sudoku_file(FILE *fp);
+static bool process_sudoku_file_threaded(FILE *fp, int n_threads);
+static void process_grid_file(FILE *fp);
+
+// arg as a whole number >= 0; false if it is anything else
+static bool parse_count(const char *arg, long *n)
+{
+    char *end;
 
-static void process_sudoku_file(FILE *fp);
+    errno = 0;
+    *n = strtol(arg, &end, 10);
+    return end != arg && *end == '\0' && errno == 0 && *n >= 0;
+}
+
+// The same for any number >= 0
+static bool parse_number(const char *arg, double *x)
+{
+    char *end;
+
+    errno = 0;
+    *x = strtod(arg, &end);
+    return end != arg && *end == '\0' && errno == 0 && *x >= 0;
+}
 
 int main(int argc, char **argv)
 {
+    const char *cache_fn = NULL;
 
     static struct option long_options[] = {
         {"help",              no_argument, 0, 'h'},
@@ -23,16 +69,35 @@ int main(int argc, char **argv)
         {"count-solutions",   no_argument, 0, 'c'},
         {"do-not-count",      no_argument, 0, 'C'},
         {"short-output",      no_argument, 0, 's'},
-        {"timeit",            required_argument, 0, 't'}
+        {"timeit",            required_argument, 0, 't'},
+        {"engine",            required_argument, 0, 'e'},
+        {"threads",           required_argument, 0, 'j'},
+        {"search-threads",    required_argument, 0, 'J'},
+        {"stats",             no_argument, 0, 'S'},
+        {"max-solutions",     required_argument, 0, 'm'},
+        {"stream",            no_argument, 0, 'A'},
+        {"cache",             no_argument, 0, 'k'},
+        {"cache-file",        required_argument, 0, 'K'},
+        {"binary",            no_argument, 0, 'b'},
+        {"convert",           no_argument, 0, 'x'},
+        {"range",             required_argument, 0, 'r'},
+        {"size",              required_argument, 0, 'n'},
+        {"propagation",       required_argument, 0, 'p'},
+        {"branching",         required_argument, 0, 'B'},
+        {"time-limit",        required_argument, 0, 'T'},
+        {"guess-limit",       required_argument, 0, 'G'},
+        {0, 0, 0, 0}
     };
 
     int c;
-    while ((c = getopt_long(argc, argv, "hacCs", long_options, NULL))
+    while ((c = getopt_long(argc, argv, "haAcCse:j:J:Sm:kK:bxr:n:p:B:T:G:", long_options, NULL))
                 != -1) {
         switch (c) {
             case 'h':
                 fprintf(stderr,
-                    "Usage: %s [-h] [-aCcs] sudoku_file ...\n"
+                    "Usage: %s [-h] [-aACcsS] [-e engine] [-p level] [-B order] [-j threads]\n"
+                    "       [-J threads] [-m n] [-T ms] [-G n] [-k] [-K file] [-bx]\n"
+                    "       [-r range] [-n size] sudoku_file ...\n"
                     "\n"
                     "Options:\n"
                     "    --help -h\n"
@@ -43,10 +108,70 @@ int main(int argc, char **argv)
                     "        Do not count how many solutions there are\n"
                     "    --all -a\n"
                     "        Find all solutions to the puzzles (overrides -c, -C)\n"
+                    "    --stream -A\n"
+                    "        Like --all, but print every solution as soon as it is\n"
+                    "        found, followed by the count. Memory use does not grow\n"
+                    "        with the number of solutions.\n"
                     "    --short-output -s\n"
                     "        Use a shorter output format.\n"
                     "    --timeit=iterations\n"
-                    "        Time the solver.\n",
+                    "        Time the solver.\n"
+                    "    --engine=engine -e engine\n"
+                    "        Solver engine: bitboard (default), classic, trail or\n"
+                    "        dlx (exact cover, often best for --all).\n"
+                    "    --propagation=level -p level\n"
+                    "        What the classic and trail engines deduce before\n"
+                    "        they guess: singles (default), locked (plus locked\n"
+                    "        candidates), subsets (plus naked and hidden pairs and\n"
+                    "        triples) or fish (plus X-wings).\n"
+                    "    --branching=order -B order\n"
+                    "        What the classic and trail engines guess on: first\n"
+                    "        (default: the first cell with the fewest digits),\n"
+                    "        degree (of those, the one with the most open peers),\n"
+                    "        places (or a digit with fewer places left in a row,\n"
+                    "        column or box) or random (digits in random order,\n"
+                    "        restarting now and then when one solution will do).\n"
+                    "    --threads=N -j N\n"
+                    "        Solve with N worker threads. The output stays in\n"
+                    "        input order. Where the CPU allows, the workers first\n"
+                    "        propagate 16 puzzles at a time, which settles most\n"
+                    "        easy puzzles without a search.\n"
+                    "    --search-threads=N -J N\n"
+                    "        Count or enumerate the solutions of each puzzle with\n"
+                    "        N threads. With --all, the order of the solutions\n"
+                    "        is not fixed.\n"
+                    "    --stats -S\n"
+                    "        Print search statistics for every puzzle and in\n"
+                    "        total. Needs a build with SOLVER_STATS=1.\n"
+                    "    --max-solutions=n -m n\n"
+                    "        Stop counting or enumerating after n solutions.\n"
+                    "    --time-limit=ms -T ms\n"
+                    "    --guess-limit=n -G n\n"
+                    "        Give up on a puzzle after ms milliseconds, or after\n"
+                    "        n guesses. It is then reported as timeout, with the\n"
+                    "        solutions found so far.\n"
+                    "    --cache -k\n"
+                    "        Solve puzzles that are equal up to symmetry only once.\n"
+                    "        Not used with --all, --max-solutions or --timeit.\n"
+                    "    --cache-file=file -K file\n"
+                    "        Like --cache, and keep the cache in file between runs.\n"
+                    "    --binary -b\n"
+                    "        Write a binary corpus to stdout: each puzzle with its\n"
+                    "        solution and (unless -C) solution count.\n"
+                    "    --convert -x\n"
+                    "        Do not solve, only copy the puzzles: one per line, or\n"
+                    "        as a binary corpus with -b. Solutions and counts\n"
+                    "        stored in a binary input follow on the same line.\n"
+                    "    --range=a-b -r a-b\n"
+                    "        Only read the puzzles numbered a to b (counting from\n"
+                    "        0) of each input, e.g. one shard of a corpus.\n"
+                    "    --size=side -n side\n"
+                    "        Solve grids of this side: 4, 9 (default), 16 or 25.\n"
+                    "        Digits above 9 are the letters A to P. Other sizes\n"
+                    "        have their own solver, which takes -a, -A, -c, -C,\n"
+                    "        -m, -s and -S only.\n"
+                    "\n"
+                    "Binary corpora are recognized on input.\n",
                     argv[0]);
                 return 0;
             case 'c':
@@ -58,19 +183,159 @@ int main(int argc, char **argv)
             case 'a':
                 all_solutions = true;
                 break;
+            case 'A':
+                all_solutions = true;
+                stream_solutions = true;
+                break;
             case 's':
                 short_output = true;
                 break;
             case 't':
                 timeit_iters = atoi(optarg);
                 break;
+            case 'j':
+                n_threads = atoi(optarg);
+                break;
+            case 'J':
+                search_threads = atoi(optarg);
+                break;
+            case 'S':
+                if (!SOLVER_STATS) {
+                    fprintf(stderr, "ERROR: built without search statistics, "
+                                    "rebuild with make STATS=1\n");
+                    return 2;
+                }
+                print_stats = true;
+                break;
+            case 'm': {
+                long n;
+                if (!parse_count(optarg, &n) || n > INT_MAX) {
+                    fprintf(stderr, "ERROR: bad solution limit %s\n", optarg);
+                    return 2;
+                }
+                max_solutions = n;
+                break;
+            }
+            case 'K':
+                cache_fn = optarg;
+                /* fall through */
+            case 'k':
+                if (cache == NULL && (cache = solution_cache_new()) == NULL)
+                    fprintf(stderr, "Not enough memory for the cache, "
+                                    "solving without it\n");
+                break;
+            case 'b':
+                binary_output = true;
+                break;
+            case 'x':
+                convert_only = true;
+                break;
+            case 'r':
+                range_first = 0;
+                range_last = -1;
+                if (!parse_range(optarg, &range_first, &range_last)
+                        || range_first < 0
+                        || (range_last >= 0 && range_first > range_last)) {
+                    fprintf(stderr, "ERROR: bad range %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'p':
+                if (!solver_propagation_from_name(optarg, &solver_propagation)) {
+                    fprintf(stderr, "ERROR: unknown propagation level %s\n",
+                            optarg);
+                    return 2;
+                }
+                break;
+            case 'T': {
+                double ms;
+                if (!parse_number(optarg, &ms) || ms == 0) {
+                    fprintf(stderr, "ERROR: bad time limit %s\n", optarg);
+                    return 2;
+                }
+                limits.max_seconds = ms / 1000.0;
+                break;
+            }
+            case 'G': {
+                long n;
+                if (!parse_count(optarg, &n) || n == 0) {
+                    fprintf(stderr, "ERROR: bad guess limit %s\n", optarg);
+                    return 2;
+                }
+                limits.max_nodes = n;
+                break;
+            }
+            case 'B':
+                if (!solver_branching_from_name(optarg, &solver_branching)) {
+                    fprintf(stderr, "ERROR: unknown branching %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'n':
+                grid_box = grid_box_from_side(atoi(optarg));
+                if (grid_box == 0) {
+                    fprintf(stderr, "ERROR: no grids of size %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'e':
+                if (!solver_engine_from_name(optarg, &solver_engine)) {
+                    fprintf(stderr, "ERROR: unknown engine %s\n", optarg);
+                    return 2;
+                }
+                break;
             default:
                 return 2;
         }
     }
 
+    if (stream_solutions && timeit_iters) {
+        fprintf(stderr, "ERROR: --stream cannot be combined with --timeit\n");
+        return 2;
+    }
+
+    if (binary_output && !convert_only
+            && (all_solutions || timeit_iters || print_stats)) {
+        fprintf(stderr, "ERROR: --binary cannot be combined with --all, "
+                        "--stream, --timeit or --stats\n");
+        return 2;
+    }
+
+    if (grid_box != 3 && (binary_output || convert_only || cache
+                          || timeit_iters || n_threads > 0
+                          || search_threads > 1 || range_first > 0
+                          || range_last >= 0)) {
+        fprintf(stderr, "ERROR: --size only works with --all, --stream, "
+                        "--count-solutions, --do-not-count, --max-solutions, "
+                        "--time-limit, --guess-limit, --short-output and "
+                        "--stats\n");
+        return 2;
+    }
+
+    int64_t corpus_start = 0;
+    if (binary_output) {
+        if (!convert_only)
+            corpus_flags = SUDOKU_CORPUS_SOLUTION
+                           | (count_solutions ? SUDOKU_CORPUS_COUNT : 0);
+        corpus_start = sudoku_corpus_begin(stdout, corpus_flags,
+                                           SUDOKU_CORPUS_UNKNOWN);
+        if (corpus_start < 0) {
+            perror("ERROR: writing the corpus header");
+            return 1;
+        }
+    }
+
+    if (cache_fn && cache) {
+        FILE *fp = fopen(cache_fn, "r");
+        if (fp) {
+            solution_cache_load(cache, fp);
+            fclose(fp);
+        }
+    }
+
     if (optind == argc) {
-        process_sudoku_file(stdin);
+        if (!process_file(stdin))
+            return 1;
     } else {
         for (int i=optind; i<argc; ++i) {
             char *fn = argv[i];
@@ -86,38 +351,87 @@ int main(int argc, char **argv)
                 }
             }
 
-            process_sudoku_file(fp);
+            if (!process_file(fp))
+                return 1;
+        }
+    }
+
+    // Fill in the number of records, if stdout is a file
+    if (binary_output)
+        sudoku_corpus_finish(stdout, corpus_start, corpus_flags);
+
+    if (cache_fn && cache) {
+        FILE *fp = fopen(cache_fn, "w");
+        if (!fp) {
+            fprintf(stderr, "Error opening %s: ", cache_fn);
+            perror(NULL);
+            return 1;
         }
+        solution_cache_save(cache, fp);
+        fclose(fp);
     }
+    if (cache)
+        solution_cache_free(cache);
+    return 0;
 }
 
-struct solutions_list;
+// The solutions of one puzzle, kept in chunks so that saving one is O(1)
+#define SOLUTION_CHUNK 256
+
+struct solution_chunk {
+    struct solution_chunk *next;
+    int n;
+    sudoku_t fields[SOLUTION_CHUNK];
+};
+
 struct solutions_list {
-    sudoku_t field;
-    struct solutions_list *next;
+    struct solution_chunk *first, *last;
 };
 
-struct solutions_list *new_solutions_list()
+void init_solutions_list(struct solutions_list *lst)
 {
-    struct solutions_list *lst = malloc(sizeof(struct solutions_list));
-    lst->next = NULL;
-    return lst;
+    lst->first = lst->last = NULL;
 }
 
-void save_solution(struct solutions_list *lst, sudoku_t s)
+bool save_solution(struct solutions_list *lst, sudoku_t s)
 {
-    while (lst->next)
-        lst = lst->next;
+    struct solution_chunk *c = lst->last;
 
-    memcpy(lst->field, s, sizeof(sudoku_t));
-    lst->next = new_solutions_list();
+    if (c == NULL || c->n == SOLUTION_CHUNK) {
+        c = malloc(sizeof(struct solution_chunk));
+        c->next = NULL;
+        c->n = 0;
+        if (lst->last)
+            lst->last->next = c;
+        else
+            lst->first = c;
+        lst->last = c;
+    }
+
+    memcpy(c->fields[c->n++], s, sizeof(sudoku_t));
+    return true;
 }
 
 void free_solutions_list(struct solutions_list *lst)
 {
-    if (lst->next)
-        free_solutions_list(lst->next);
-    free(lst);
+    while (lst->first) {
+        struct solution_chunk *next = lst->first->next;
+        free(lst->first);
+        lst->first = next;
+    }
+    lst->last = NULL;
+}
+
+// Collector for --stream: write the solution out right away
+static bool stream_solution(struct sudoku_writer *out, sudoku_t s)
+{
+    sudoku_writer_sudoku(out, s, short_output);
+    if (short_output)
+        sudoku_writer_write(out, "\n", 1);
+    else
+        sudoku_writer_puts(out, "");
+    sudoku_writer_poll(out);
+    return true;
 }
 
 #define TIMEIT(VAR, STMT) \
@@ -132,106 +446,701 @@ void free_solutions_list(struct solutions_list *lst)
               + (_TIMEIT_t1.tv_usec - _TIMEIT_t0.tv_usec) / 1000.0; \
     }
 
-void process_sudoku_file(FILE *fp)
+static int count_or_collect(sudoku_t s, struct solutions_list *solutions,
+                            struct sudoku_writer *out,
+                            const struct solver_options *opts)
 {
-    sudoku_t s, buffer;
-    double dt_ms = 0;
+    if (stream_solutions)
+        return _solve_parallel(s, true, (solution_collector)stream_solution,
+                               out, opts, search_threads);
+    else if (all_solutions)
+        return _solve_parallel(s, true, (solution_collector)save_solution,
+                               solutions, opts, search_threads);
+    else
+        return _solve_parallel(s, true, NULL, NULL, opts, search_threads);
+}
 
-    while (fill_sudoku_from_file(s, fp) > 0) {
-        if (!short_output) {
-            puts("Sudoku:");
-            print_sudoku(s, false);
-            puts("");
-        }
+static void format_stats(struct sudoku_writer *out, const char *label,
+                         const struct solver_stats *st)
+{
+    sudoku_writer_printf(out, "%s guesses=%lu backtracks=%lu imposes=%lu "
+                              "eliminations=%lu passes=%lu max_depth=%d\n",
+                         label, st->guesses, st->backtracks, st->imposes,
+                         st->eliminations, st->passes, st->max_depth);
+}
 
-        if (count_solutions || all_solutions) {
-            int solution_count = 0;
-            struct solutions_list *solutions;
-            solutions = new_solutions_list();
+// b set up from --time-limit and --guess-limit for the next puzzle, or
+// NULL if neither was given
+static struct solver_budget *start_budget(struct solver_budget *b)
+{
+    if (limits.max_nodes == 0 && limits.max_seconds <= 0)
+        return NULL;
+    *b = limits;
+    solver_budget_start(b);
+    return b;
+}
 
-            if (timeit_iters == 0) {
-                if (all_solutions) {
-                    solution_count = collect_all_solutions(s,
-                        (solution_collector)save_solution, solutions);
-                } else {
-                    solution_count = count_sudoku_solutions(s);
-                }
-            } else {
-                memcpy(buffer, s, sizeof(sudoku_t));
-                TIMEIT(dt_ms, memcpy(s, buffer, sizeof(sudoku_t));
-                              if (all_solutions) {
-                                  free_solutions_list(solutions);
-                                  solutions = new_solutions_list();
-                                  solution_count = collect_all_solutions(s, 
-                                    (solution_collector)save_solution, solutions);
-                              } else {
-                                  solution_count = count_sudoku_solutions(s);
-                              })
+static bool timed_out(const struct solver_options *opts)
+{
+    return opts->budget != NULL && opts->budget->exceeded;
+}
+
+static bool cache_get(const sudoku_digits_t puzzle, sudoku_digits_t solution,
+                      int *count)
+{
+    return solution_cache_lookup(cache, puzzle, solution, count)
+           && (!count_solutions || *count != CACHE_NOT_COUNTED);
+}
+
+// Solve s, or count its solutions, through the cache. Puzzles are solved
+// in canonical form, so equivalent puzzles are solved only once; the
+// puzzle as given is cached too, which makes exact repeats cheaper still.
+// Returns the count, or with -C whether there is a solution.
+static int solve_cached(sudoku_t s, const struct solver_options *opts)
+{
+    sudoku_digits_t puzzle, canon, solution;
+    struct sudoku_transform t;
+    sudoku_t buffer;
+    int count;
+
+    sudoku_to_digits(s, puzzle);
+    if (cache_get(puzzle, solution, &count)) {
+        digits_to_sudoku(solution, s);
+    } else {
+        canonicalize_sudoku(s, canon, &t);
+        if (!cache_get(canon, solution, &count)) {
+            digits_to_sudoku(canon, buffer);
+            if (count_solutions)
+                count = _solve_parallel(buffer, true, NULL, NULL, opts,
+                                        search_threads);
+            else if (_solve_with(buffer, false, NULL, NULL, opts) > 0)
+                count = CACHE_NOT_COUNTED;
+            else
+                count = 0;
+            if (timed_out(opts)) {
+                // Not worth keeping: the next run may get further
+                if (count != 0)
+                    undo_transform(buffer, &t, s);
+                return count_solutions ? count : count != 0;
             }
+            sudoku_to_digits(buffer, solution);
+            solution_cache_insert(cache, canon, solution, count);
+        }
+
+        digits_to_sudoku(solution, buffer);
+        undo_transform(buffer, &t, s);
+        sudoku_to_digits(s, solution);
+        solution_cache_insert(cache, puzzle, solution, count);
+    }
 
-            if (short_output) {
+    return count_solutions ? count : count != 0;
+}
+
+// Take the result of lane propagation for a puzzle it settled: either
+// the grid is solved, and is then the only solution, or it has no
+// solution. Returns the number of solutions.
+static int take_settled(sudoku_t s, sudoku_t settled)
+{
+    if (check_solution(settled) != SUDOKU_DONE)
+        return 0;
+    memcpy(s, settled, sizeof(sudoku_t));
+    return 1;
+}
+
+// Solve s and append its record to the binary corpus in out
+static void solve_and_record(sudoku_t s, sudoku_t settled,
+                             struct sudoku_writer *out)
+{
+    sudoku_t puzzle;
+    struct solver_budget budget;
+    struct solver_options options = { NULL, max_solutions, PROPAGATE_DEFAULT,
+                                      BRANCH_DEFAULT, start_budget(&budget) };
+    int count;
+
+    memcpy(puzzle, s, sizeof(sudoku_t));
+    if (settled)
+        count = take_settled(s, settled);
+    else if (cache && max_solutions == 0)
+        count = solve_cached(s, &options);
+    else if (count_solutions)
+        count = _solve_parallel(s, true, NULL, NULL, &options, search_threads);
+    else
+        count = _solve_with(s, false, NULL, NULL, &options) > 0;
+
+    sudoku_writer_record(out, corpus_flags, puzzle, count > 0 ? s : NULL,
+                         timed_out(&options) ? SUDOKU_COUNT_TIMEOUT : count);
+}
+
+// Solve s and append the report to out. settled, if not NULL, is what
+// lane propagation made of s. With --stats, the statistics of this
+// puzzle are also added to total.
+static void solve_and_format(sudoku_t s, sudoku_t settled,
+                             struct sudoku_writer *out,
+                             struct solver_stats *total)
+{
+    sudoku_t buffer;
+    double dt_ms = 0;
+    struct solver_stats stats;
+    struct solver_budget budget;
+    struct solver_options options = { print_stats ? &stats : NULL,
+                                      max_solutions, PROPAGATE_DEFAULT,
+                                      BRANCH_DEFAULT, start_budget(&budget) };
+    const struct solver_options *opts = &options;
+
+    bool use_cache = cache && !all_solutions && max_solutions == 0
+                     && timeit_iters == 0;
+
+    if (binary_output) {
+        solve_and_record(s, settled, out);
+        return;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+
+    if (!short_output) {
+        sudoku_writer_puts(out, "Sudoku:");
+        sudoku_writer_sudoku(out, s, false);
+        sudoku_writer_puts(out, "");
+    }
+
+    if (count_solutions || all_solutions) {
+        int solution_count = 0;
+        struct solutions_list solutions;
+        init_solutions_list(&solutions);
+
+        if (settled) {
+            solution_count = take_settled(s, settled);
+        } else if (use_cache) {
+            solution_count = solve_cached(s, opts);
+        } else if (timeit_iters == 0) {
+            solution_count = count_or_collect(s, &solutions, out, opts);
+        } else {
+            memcpy(buffer, s, sizeof(sudoku_t));
+            TIMEIT(dt_ms, memcpy(s, buffer, sizeof(sudoku_t));
+                          free_solutions_list(&solutions);
+                          memset(&stats, 0, sizeof(stats));
+                          start_budget(&budget);
+                          solution_count = count_or_collect(s, &solutions, out, opts);)
+        }
+
+        if (short_output) {
+            if (timed_out(opts)) {
                 if (solution_count != 0) {
-                    print_sudoku(s, true);
-                    if (timeit_iters)
-                        printf(" %d %f\n", solution_count, dt_ms/timeit_iters);
-                    else
-                        printf(" %d\n", solution_count);
-                } else {
-                    printf("no solution\n");
+                    sudoku_writer_sudoku(out, s, true);
+                    sudoku_writer_write(out, " ", 1);
+                }
+                sudoku_writer_printf(out, "timeout %d", solution_count);
+                if (timeit_iters)
+                    sudoku_writer_printf(out, " %f", dt_ms/timeit_iters);
+                sudoku_writer_write(out, "\n", 1);
+            } else if (solution_count != 0) {
+                sudoku_writer_sudoku(out, s, true);
+                if (timeit_iters)
+                    sudoku_writer_printf(out, " %d %f\n", solution_count, dt_ms/timeit_iters);
+                else
+                {
+                    sudoku_writer_write(out, " ", 1);
+                    sudoku_writer_int(out, solution_count);
+                    sudoku_writer_write(out, "\n", 1);
                 }
             } else {
-                if (solution_count != 0) {
-                    if (solution_count == 1)
-                        printf("\nThere is 1 solution.\n");
-                    else
-                        printf("\nThere are %d solutions.\n", solution_count);
-                    
-                    if (all_solutions) {
-                        struct solutions_list *lst = solutions;
-                        while (lst->next) {
-                            print_sudoku(lst->field, false);
-                            puts("");
-                            lst = lst->next;
+                sudoku_writer_puts(out, "no solution");
+            }
+        } else {
+            if (timed_out(opts))
+                sudoku_writer_printf(out, "\nTimeout: gave up after %lu guesses.\n",
+                                     budget.nodes);
+            if (solution_count != 0) {
+                if (timed_out(opts)
+                        || (max_solutions > 0 && solution_count >= max_solutions))
+                    sudoku_writer_printf(out, "\nThere %s at least %d solution%s.\n",
+                                         solution_count == 1 ? "is" : "are",
+                                         solution_count,
+                                         solution_count == 1 ? "" : "s");
+                else if (solution_count == 1)
+                    sudoku_writer_printf(out, "\nThere is 1 solution.\n");
+                else
+                    sudoku_writer_printf(out, "\nThere are %d solutions.\n", solution_count);
+
+                if (stream_solutions) {
+                    // already printed
+                } else if (all_solutions) {
+                    for (struct solution_chunk *c = solutions.first; c; c = c->next) {
+                        for (int k=0; k<c->n; ++k) {
+                            sudoku_writer_sudoku(out, c->fields[k], false);
+                            sudoku_writer_puts(out, "");
                         }
-                    } else print_sudoku(s, false);
-                } else {
-                    printf("\nThere are no solutions.\n");
-                }
+                    }
+                } else sudoku_writer_sudoku(out, s, false);
+            } else if (!timed_out(opts)) {
+                sudoku_writer_printf(out, "\nThere are no solutions.\n");
+            }
 
-                if (timeit_iters)
-                    printf("Running time %.2f s (%.2f ms per iteration)\n", dt_ms/1000.0, dt_ms/timeit_iters);
+            if (timeit_iters)
+                sudoku_writer_printf(out, "Running time %.2f s (%.2f ms per iteration)\n", dt_ms/1000.0, dt_ms/timeit_iters);
+        }
 
-                if (all_solutions)
-                    free_solutions_list(solutions);
+        free_solutions_list(&solutions);
+    } else {
+        bool solved = false;
+        if (settled)
+            solved = take_settled(s, settled);
+        else if (use_cache)
+            solved = solve_cached(s, opts);
+        else if (timeit_iters == 0)
+            solved = _solve_with(s, false, NULL, NULL, opts) > 0;
+        else {
+            memcpy(buffer, s, sizeof(sudoku_t));
+            TIMEIT(dt_ms, memcpy(s, buffer, sizeof(sudoku_t));
+                          memset(&stats, 0, sizeof(stats));
+                          start_budget(&budget);
+                          solved = _solve_with(s, false, NULL, NULL, opts) > 0;)
+        }
+        if (solved) {
+            sudoku_writer_sudoku(out, s, short_output);
+            if (timeit_iters) {
+                if (short_output)
+                    sudoku_writer_printf(out, " %f", dt_ms/timeit_iters);
+                else
+                    sudoku_writer_printf(out, "Running time %.2f s (%.2f ms per iteration)\n", dt_ms/1000.0, dt_ms/timeit_iters);
             }
+            sudoku_writer_write(out, "\n", 1);
         } else {
-            bool solved = false;
-            if (timeit_iters == 0)
-                solved = solve_sudoku(s);
-            else {
-                memcpy(buffer, s, sizeof(sudoku_t));
-                TIMEIT(dt_ms, memcpy(s, buffer, sizeof(sudoku_t));
-                              solved = solve_sudoku(s);)
+            if (timed_out(opts))
+                sudoku_writer_write(out, "timeout", 7);
+            else
+                sudoku_writer_write(out, "no solution", 11);
+            if (timeit_iters) {
+                if (short_output)
+                    sudoku_writer_printf(out, " %f", dt_ms/timeit_iters);
+                else
+                    sudoku_writer_printf(out, "Running time %.2f s (%.2f ms per iteration)\n", dt_ms/1000.0, dt_ms/timeit_iters);
             }
-            if (solved) {
-                print_sudoku(s, short_output);
-                if (timeit_iters) {
-                    if (short_output)
-                        printf(" %f", dt_ms/timeit_iters);
-                    else
-                        printf("Running time %.2f s (%.2f ms per iteration)\n", dt_ms/1000.0, dt_ms/timeit_iters);
+            sudoku_writer_write(out, "\n", 1);
+        }
+    }
+
+    if (print_stats) {
+        format_stats(out, "stats", &stats);
+        solver_stats_add(total, &stats);
+    }
+}
+
+// The reader for fp, or NULL after an error message
+static struct sudoku_reader *open_input(FILE *fp)
+{
+    struct sudoku_reader *reader = sudoku_reader_open(fp);
+
+    if (reader == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return NULL;
+    }
+    if (range_first > 0 || range_last >= 0) {
+        uint64_t n = UINT64_MAX;
+        if (range_last >= 0)
+            n = range_last - range_first + 1;
+        sudoku_reader_select(reader, range_first, n);
+    }
+    return reader;
+}
+
+// --convert: copy the puzzles to stdout without solving them
+static bool convert_sudoku_file(FILE *fp)
+{
+    sudoku_t s, solution;
+    int count;
+    struct sudoku_writer out;
+    struct sudoku_reader *reader = open_input(fp);
+
+    if (reader == NULL)
+        return false;
+
+    sudoku_writer_init(&out, stdout);
+
+    while (sudoku_reader_next_record(reader, s, solution, &count) > 0) {
+        if (binary_output) {
+            sudoku_writer_record(&out, corpus_flags, s, NULL, 0);
+        } else {
+            sudoku_writer_sudoku(&out, s, true);
+            if (reader->flags & SUDOKU_CORPUS_SOLUTION) {
+                sudoku_writer_write(&out, " ", 1);
+                sudoku_writer_sudoku(&out, solution, true);
+            }
+            if (reader->flags & SUDOKU_CORPUS_COUNT) {
+                sudoku_writer_write(&out, " ", 1);
+                if (count == SUDOKU_COUNT_TIMEOUT)
+                    sudoku_writer_write(&out, "timeout", 7);
+                else
+                    sudoku_writer_int(&out, count);
+            }
+            sudoku_writer_write(&out, "\n", 1);
+        }
+        sudoku_writer_poll(&out);
+    }
+
+    sudoku_writer_flush(&out);
+    sudoku_writer_free(&out);
+    sudoku_reader_close(reader);
+    return true;
+}
+
+static bool process_sudoku_file(FILE *fp)
+{
+    sudoku_t s;
+    struct sudoku_writer out;
+    struct sudoku_reader *reader = open_input(fp);
+    bool interactive = isatty(fileno(stdout));
+    struct solver_stats total = { 0 };
+
+    if (reader == NULL)
+        return false;
+
+    sudoku_writer_init(&out, stdout);
+
+    while (sudoku_reader_next(reader, s) > 0) {
+        solve_and_format(s, NULL, &out, &total);
+        if (interactive)
+            sudoku_writer_flush(&out);
+        else
+            sudoku_writer_poll(&out);
+    }
+
+    if (print_stats)
+        format_stats(&out, "stats total", &total);
+    sudoku_writer_flush(&out);
+    sudoku_writer_free(&out);
+    sudoku_reader_close(reader);
+    return true;
+}
+
+/*
+ * --size: grids other than 9x9. They go through grid_solve one at a time,
+ * with the output of solve_and_format.
+ */
+
+// Collector for --all and --stream: write the solution out as it comes
+static bool write_grid_solution(void *p, const struct grid *g)
+{
+    struct sudoku_writer *w = p;
+
+    sudoku_writer_grid(w, g, short_output);
+    if (short_output)
+        sudoku_writer_write(w, "\n", 1);
+    else
+        sudoku_writer_puts(w, "");
+    sudoku_writer_poll(w);
+    return true;
+}
+
+// found collects the solutions for --all until the count is out
+static void solve_grid_and_format(struct grid *g, struct sudoku_writer *out,
+                                  struct sudoku_writer *found,
+                                  struct solver_stats *total)
+{
+    struct solver_stats stats;
+    struct solver_budget budget;
+    struct solver_options options = { print_stats ? &stats : NULL,
+                                      max_solutions, PROPAGATE_DEFAULT,
+                                      BRANCH_DEFAULT, start_budget(&budget) };
+
+    memset(&stats, 0, sizeof(stats));
+
+    if (!short_output) {
+        sudoku_writer_puts(out, "Sudoku:");
+        sudoku_writer_grid(out, g, false);
+        sudoku_writer_puts(out, "");
+    }
+
+    if (count_solutions || all_solutions) {
+        int solution_count;
+
+        found->len = 0;
+        if (stream_solutions)
+            solution_count = grid_solve(g, true, write_grid_solution, out,
+                                        &options);
+        else if (all_solutions)
+            solution_count = grid_solve(g, true, write_grid_solution, found,
+                                        &options);
+        else
+            solution_count = grid_solve(g, true, NULL, NULL, &options);
+
+        if (short_output) {
+            if (timed_out(&options)) {
+                if (solution_count != 0) {
+                    sudoku_writer_grid(out, g, true);
+                    sudoku_writer_write(out, " ", 1);
                 }
-                printf("\n");
+                sudoku_writer_printf(out, "timeout %d\n", solution_count);
+            } else if (solution_count != 0) {
+                sudoku_writer_grid(out, g, true);
+                sudoku_writer_printf(out, " %d\n", solution_count);
             } else {
-                printf("no solution");
-                if (timeit_iters) {
-                    if (short_output)
-                        printf(" %f", dt_ms/timeit_iters);
-                    else
-                        printf("Running time %.2f s (%.2f ms per iteration)\n", dt_ms/1000.0, dt_ms/timeit_iters);
-                }
-                printf("\n");
+                sudoku_writer_puts(out, "no solution");
             }
+            solution_count = -1;    // reported
+        } else if (timed_out(&options)) {
+            sudoku_writer_printf(out, "\nTimeout: gave up after %lu guesses.\n",
+                                 budget.nodes);
         }
+        if (solution_count > 0) {
+            if (timed_out(&options)
+                    || (max_solutions > 0 && solution_count >= max_solutions))
+                sudoku_writer_printf(out, "\nThere %s at least %d solution%s.\n",
+                                     solution_count == 1 ? "is" : "are",
+                                     solution_count,
+                                     solution_count == 1 ? "" : "s");
+            else if (solution_count == 1)
+                sudoku_writer_printf(out, "\nThere is 1 solution.\n");
+            else
+                sudoku_writer_printf(out, "\nThere are %d solutions.\n", solution_count);
+
+            if (all_solutions && !stream_solutions)
+                sudoku_writer_write(out, found->buf, found->len);
+            else if (!all_solutions)
+                sudoku_writer_grid(out, g, false);
+        } else if (solution_count == 0 && !timed_out(&options)) {
+            sudoku_writer_printf(out, "\nThere are no solutions.\n");
+        }
+    } else {
+        if (grid_solve(g, false, NULL, NULL, &options) > 0) {
+            sudoku_writer_grid(out, g, short_output);
+            sudoku_writer_write(out, "\n", 1);
+        } else if (timed_out(&options)) {
+            sudoku_writer_puts(out, "timeout");
+        } else {
+            sudoku_writer_puts(out, "no solution");
+        }
+    }
+
+    if (print_stats) {
+        format_stats(out, "stats", &stats);
+        solver_stats_add(total, &stats);
+    }
+}
+
+static void process_grid_file(FILE *fp)
+{
+    struct grid g;
+    struct sudoku_writer out, found;
+    bool interactive = isatty(fileno(stdout));
+    struct solver_stats total = { 0 };
+    int cells = grid_box * grid_box * grid_box * grid_box;
+
+    sudoku_writer_init(&out, stdout);
+    sudoku_writer_init(&found, NULL);
+
+    while (grid_read(&g, grid_box, fp) == cells) {
+        solve_grid_and_format(&g, &out, &found, &total);
+        if (interactive)
+            sudoku_writer_flush(&out);
+        else
+            sudoku_writer_poll(&out);
+    }
+
+    if (print_stats)
+        format_stats(&out, "stats total", &total);
+    sudoku_writer_flush(&out);
+    sudoku_writer_free(&out);
+    sudoku_writer_free(&found);
+}
+
+/*
+ * Threaded batch mode: the calling thread reads puzzles into a ring of
+ * batches, worker threads solve whole batches into their output text, and
+ * a writer thread prints the batches in input order.
+ */
+
+#define BATCH_SIZE 64
+
+struct batch {
+    sudoku_t puzzles[BATCH_SIZE];
+    int n;
+    sudoku_t lanes[BATCH_SIZE];     // the puzzles after lane propagation
+    bool settled[BATCH_SIZE];       // ... if that solved or refuted them
+    struct sudoku_writer out;
+    struct solver_stats stats;
+    enum { BATCH_FREE, BATCH_READ, BATCH_SOLVED } state;
+};
+
+struct pipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct batch *ring;
+    int ring_size;
+    long n_read;        // batches handed over by the reader
+    long n_claimed;     // batches taken by a worker
+    long n_written;     // batches printed by the writer
+    bool eof;
+};
+
+// Lane mode gives the same answers, but no statistics or timings, and
+// only settles puzzles with at most one solution
+static bool use_lanes(void)
+{
+    return !all_solutions && !print_stats && timeit_iters == 0;
+}
+
+// Propagate the batch SIMD_LANES puzzles at a time. Easy puzzles come out
+// solved and need no search of their own; the rest are solved from
+// scratch as usual.
+static void settle_batch(struct batch *b)
+{
+    memset(b->settled, 0, sizeof(b->settled));
+    if (!use_lanes())
+        return;
+
+    memcpy(b->lanes, b->puzzles, b->n * sizeof(sudoku_t));
+    for (int i=0; i<b->n; i+=SIMD_LANES) {
+        int n = b->n - i < SIMD_LANES ? b->n - i : SIMD_LANES;
+        if (!simd_propagate_lanes(b->lanes + i, n))
+            return;
+    }
+    for (int i=0; i<b->n; ++i)
+        b->settled[i] = check_solution(b->lanes[i]) != SUDOKU_IN_PROGRESS;
+}
+
+static void *solver_thread(void *arg)
+{
+    struct pipeline *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->n_claimed == p->n_read && !p->eof)
+            pthread_cond_wait(&p->changed, &p->lock);
+        if (p->n_claimed == p->n_read)
+            break;
+
+        struct batch *b = &p->ring[p->n_claimed++ % p->ring_size];
+        pthread_mutex_unlock(&p->lock);
+
+        b->out.len = 0;
+        memset(&b->stats, 0, sizeof(b->stats));
+        settle_batch(b);
+        for (int i=0; i<b->n; ++i)
+            solve_and_format(b->puzzles[i],
+                             b->settled[i] ? b->lanes[i] : NULL,
+                             &b->out, &b->stats);
+
+        pthread_mutex_lock(&p->lock);
+        b->state = BATCH_SOLVED;
+        pthread_cond_broadcast(&p->changed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+    struct pipeline *p = arg;
+    struct sudoku_writer out;
+    struct solver_stats total = { 0 };
+
+    sudoku_writer_init(&out, stdout);
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        struct batch *b = &p->ring[p->n_written % p->ring_size];
+        if (!(p->n_written < p->n_read && b->state == BATCH_SOLVED)) {
+            // Nothing to print right now: pass on what we have
+            pthread_mutex_unlock(&p->lock);
+            sudoku_writer_flush(&out);
+            pthread_mutex_lock(&p->lock);
+        }
+        while (!(p->n_written < p->n_read && b->state == BATCH_SOLVED)
+               && !(p->n_written == p->n_read && p->eof))
+            pthread_cond_wait(&p->changed, &p->lock);
+        if (p->n_written == p->n_read)
+            break;
+        pthread_mutex_unlock(&p->lock);
+
+        sudoku_writer_write(&out, b->out.buf, b->out.len);
+        sudoku_writer_poll(&out);
+        solver_stats_add(&total, &b->stats);
+
+        pthread_mutex_lock(&p->lock);
+        b->state = BATCH_FREE;
+        p->n_written++;
+        pthread_cond_broadcast(&p->changed);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    if (print_stats)
+        format_stats(&out, "stats total", &total);
+    sudoku_writer_flush(&out);
+    sudoku_writer_free(&out);
+    return NULL;
+}
+
+static bool process_sudoku_file_threaded(FILE *fp, int n_threads)
+{
+    struct pipeline p;
+    pthread_t workers[n_threads], writer;
+    struct sudoku_reader *reader = open_input(fp);
+
+    if (reader == NULL)
+        return false;
+
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.changed, NULL);
+    p.ring_size = 4 * n_threads;
+    p.ring = calloc(p.ring_size, sizeof(struct batch));
+    for (int i=0; i<p.ring_size; ++i)
+        sudoku_writer_init(&p.ring[i].out, NULL);
+    p.n_read = p.n_claimed = p.n_written = 0;
+    p.eof = false;
+
+    for (int i=0; i<n_threads; ++i)
+        pthread_create(&workers[i], NULL, solver_thread, &p);
+    pthread_create(&writer, NULL, writer_thread, &p);
+
+    while (!p.eof) {
+        struct batch *b = &p.ring[p.n_read % p.ring_size];
+
+        pthread_mutex_lock(&p.lock);
+        while (b->state != BATCH_FREE)
+            pthread_cond_wait(&p.changed, &p.lock);
+        pthread_mutex_unlock(&p.lock);
+
+        // The slot is ours until we publish it
+        b->n = 0;
+        while (b->n < BATCH_SIZE
+               && sudoku_reader_next(reader, b->puzzles[b->n]) > 0)
+            b->n++;
+
+        pthread_mutex_lock(&p.lock);
+        if (b->n > 0) {
+            b->state = BATCH_READ;
+            p.n_read++;
+        }
+        if (b->n < BATCH_SIZE)
+            p.eof = true;
+        pthread_cond_broadcast(&p.changed);
+        pthread_mutex_unlock(&p.lock);
+    }
+
+    for (int i=0; i<n_threads; ++i)
+        pthread_join(workers[i], NULL);
+    pthread_join(writer, NULL);
+
+    sudoku_reader_close(reader);
+    for (int i=0; i<p.ring_size; ++i)
+        sudoku_writer_free(&p.ring[i].out);
+    free(p.ring);
+    pthread_cond_destroy(&p.changed);
+    pthread_mutex_destroy(&p.lock);
+    return true;
+}
+
+// Solve or convert everything in fp; false if it could not be read
+static bool process_file(FILE *fp)
+{
+    if (grid_box != 3) {
+        process_grid_file(fp);
+        return true;
     }
+    if (convert_only)
+        return convert_sudoku_file(fp);
+    if (n_threads > 0)
+        return process_sudoku_file_threaded(fp, n_threads);
+    return process_sudoku_file(fp);
 }